@@ -10,7 +10,7 @@ project "go2"
    language "C"
    files { "src/**.h", "src/**.c" }
    buildoptions { "-Wall" }
-   linkoptions { "-lopenal -lEGL -levdev -lgbm -lpthread -ldrm -lm -lrga -lpng -lasound" }
+   linkoptions { "-lopenal -lEGL -levdev -lgbm -lpthread -ldrm -lm -ldl -lz -lasound" }
    includedirs { "/usr/include/libdrm" }
 
    configuration "Debug"
@@ -18,16 +18,24 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include "audio.h"
+#include "queue.h"
+#include "resample.h"
 
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <AL/alext.h>
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include <alsa/asoundlib.h>
 #include <alsa/mixer.h>
@@ -35,6 +43,40 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define SOUND_SAMPLES_SIZE  (2048)
 #define SOUND_CHANNEL_COUNT 2
 
+// Longest single sleep while polling for a processed buffer when the
+// OpenAL event extension is not available.
+#define AUDIO_POLL_MAX_MS (10)
+
+#define ALSA_DEFAULT_DEVICE "default"
+#define AUDIO_PERIOD_FRAMES (512)
+#define ALSA_PERIOD_COUNT   (4)
+#define OPENAL_BUFFER_COUNT (4)
+#define OPENAL_BUFFER_COUNT_MAX (64)
+
+#define RING_BLOCK_COUNT_MIN (2)
+#define FEEDER_POLL_MS (100)
+
+#define RATE_DELTA_DEFAULT (0.005)
+#define RATE_FILL_SMOOTHING (0.05)  // weight of each new fill sample
+
+
+// AL_SOFT_events is resolved at runtime so older OpenAL headers and
+// libraries still work; submit then falls back to timed polling.
+#ifndef AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT
+#define AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT 0x19A4
+#endif
+
+typedef void (*go2_al_event_proc_t)(ALenum eventType, ALuint object, ALuint param, ALsizei length, const char* message, void* userParam);
+typedef void (*go2_al_event_control_t)(ALsizei count, const ALenum* types, ALboolean enable);
+typedef void (*go2_al_event_callback_t)(go2_al_event_proc_t callback, void* userParam);
+
+// AL_SOFT_source_latency, resolved the same way.
+#ifndef AL_SAMPLE_OFFSET_LATENCY_SOFT
+#define AL_SAMPLE_OFFSET_LATENCY_SOFT 0x1200
+#endif
+
+typedef void (*go2_al_get_source_i64v_t)(ALuint source, ALenum param, int64_t* values);
+
 
 typedef struct go2_audio
 {
@@ -43,35 +85,204 @@ typedef struct go2_audio
     ALCcontext *context;
     ALuint source;
     bool isAudioInitialized;
+    go2_audio_backend_t backend;
+    snd_pcm_t* pcm;
+    int period_frames;
+    int buffer_frames;
+
+    // Playback position. OpenAL buffers are recycled in queue order, so
+    // queued_frames[queue_head] is always the oldest queued buffer.
+    pthread_mutex_t position_mutex;
+    _Atomic uint64_t frames_submitted;
+    uint64_t frames_written;    // handed to the backend
+    uint64_t frames_unqueued;   // OpenAL buffers recycled
+    ALuint* buffers;
+    int* queued_frames;
+    int buffer_count;
+    int queue_head;
+    go2_al_get_source_i64v_t get_source_i64v;
+
+    // Dynamic rate control: the resampling ratio is nudged around its
+    // nominal value so the output queue settles half full.
+    go2_resampler_t* resampler;
+    double rate_nominal;
+    double rate_delta;
+    double rate_fill;           // smoothed fill level the ratio follows
+    short* resample_buffer;
+    int resample_capacity;
+    int resample_offset;
+    int resample_pending;       // resampled frames not yet accepted downstream
+
+    // Submit ring: fixed-size blocks cycle between the caller and the
+    // feeder thread through two lock-free queues. The partial block is
+    // guarded by ring_partial_mutex so an idle feeder can take it over.
+    short* ring_memory;
+    int* ring_block_lengths;    // frames in each filled block
+    int ring_block_frames;
+    int ring_block_count;
+    go2_spsc_queue_t* ring_free;
+    go2_spsc_queue_t* ring_filled;
+    pthread_mutex_t ring_partial_mutex;
+    short* ring_partial;        // block being filled by the caller
+    int ring_partial_frames;
+    _Atomic int ring_level;     // frames not yet handed to the backend
+    pthread_t feeder_thread;
+    _Atomic bool terminating;
+
+    int event_fd;
+    go2_al_event_control_t event_control;
+    go2_al_event_callback_t event_callback;
+    int last_frames;
 } go2_audio_t;
 
 
-go2_audio_t* go2_audio_create(int frequency)
+// Called on the OpenAL event thread.
+static void go2_audio_event(ALenum eventType, ALuint object, ALuint param, ALsizei length, const char* message, void* userParam)
 {
-    go2_audio_t* result = malloc(sizeof(*result));
-    if (!result)
+    go2_audio_t* audio = (go2_audio_t*)userParam;
+
+    if (eventType == AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT)
     {
-        printf("malloc failed.\n");
-        goto out;
+        uint64_t value = 1;
+        if (write(audio->event_fd, &value, sizeof(value)) < 0)
+        {
+            // The counter can only saturate; the waiter re-checks anyway.
+        }
     }
+}
 
-    memset(result, 0, sizeof(*result));
+static void go2_audio_events_enable(go2_audio_t* audio)
+{
+    if (!alIsExtensionPresent("AL_SOFT_events"))
+    {
+        return;
+    }
+
+    go2_al_event_control_t control = (go2_al_event_control_t)alGetProcAddress("alEventControlSOFT");
+    go2_al_event_callback_t callback = (go2_al_event_callback_t)alGetProcAddress("alEventCallbackSOFT");
+    if (!control || !callback)
+    {
+        return;
+    }
+
+    callback(go2_audio_event, audio);
 
+    ALenum type = AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT;
+    control(1, &type, AL_TRUE);
 
-    result->frequency = frequency;
+    audio->event_control = control;
+    audio->event_callback = callback;
+}
+
+static void go2_audio_events_disable(go2_audio_t* audio)
+{
+    if (!audio->event_control)
+    {
+        return;
+    }
+
+    ALenum type = AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT;
+    audio->event_control(1, &type, AL_FALSE);
+    audio->event_callback(NULL, NULL);
+
+    audio->event_control = NULL;
+    audio->event_callback = NULL;
+}
+
+static int go2_audio_elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+// Waits until the source has a processed buffer to recycle. Returns 1 when
+// one is available, 0 on timeout and -1 on error.
+// timeout_ms: 0 = do not wait, -1 = wait forever.
+static int go2_audio_buffer_wait(go2_audio_t* audio, int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct pollfd pfd = { 0 };
+    pfd.fd = audio->event_fd;
+    pfd.events = POLLIN;
+
+    while (true)
+    {
+        ALint processed = 0;
+        alGetSourceiv(audio->source, AL_BUFFERS_PROCESSED, &processed);
+        if (processed)
+        {
+            return 1;
+        }
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0)
+        {
+            wait_ms = timeout_ms - go2_audio_elapsed_ms(&start);
+            if (wait_ms <= 0)
+            {
+                return 0;
+            }
+        }
+
+        // Without events, sleep for a fraction of a buffer. With events, the
+        // buffer length still bounds the sleep in case a completion is missed.
+        int slice_ms = audio->last_frames * 1000 / audio->frequency;
+        if (!audio->event_control)
+        {
+            slice_ms /= 4;
+            if (slice_ms > AUDIO_POLL_MAX_MS) slice_ms = AUDIO_POLL_MAX_MS;
+        }
+        if (slice_ms < 1) slice_ms = 1;
+
+        if (wait_ms < 0 || wait_ms > slice_ms)
+        {
+            wait_ms = slice_ms;
+        }
+
+        int ret = poll(&pfd, 1, wait_ms);
+        if (ret < 0 && errno != EINTR)
+        {
+            printf("poll failed.\n");
+            return -1;
+        }
+
+        if (ret > 0)
+        {
+            uint64_t value;
+            if (read(audio->event_fd, &value, sizeof(value)) < 0)
+            {
+                // Drained by a previous wakeup.
+            }
+        }
+    }
+}
+
+
+static int go2_audio_openal_create(go2_audio_t* result)
+{
+    result->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (result->event_fd < 0)
+    {
+        printf("eventfd failed.\n");
+        goto err_00;
+    }
 
 	result->device = alcOpenDevice(NULL);
 	if (!result->device)
 	{
 		printf("alcOpenDevice failed.\n");
-		goto err_00;
+		goto err_01;
 	}
 
 	result->context = alcCreateContext(result->device, NULL);
 	if (!alcMakeContextCurrent(result->context))
 	{
 		printf("alcMakeContextCurrent failed.\n");
-		goto err_01;
+		goto err_02;
 	}
 
 	alGenSources((ALuint)1, &result->source);
@@ -84,17 +295,650 @@ go2_audio_t* go2_audio_create(int frequency)
 
 	//memset(audioBuffer, 0, AUDIOBUFFER_LENGTH * sizeof(short));
 
-	const int BUFFER_COUNT = 4;
-	for (int i = 0; i < BUFFER_COUNT; ++i)
+    result->buffers = malloc(result->buffer_count * sizeof(*result->buffers));
+    result->queued_frames = malloc(result->buffer_count * sizeof(*result->queued_frames));
+    if (!result->buffers || !result->queued_frames)
+    {
+        printf("malloc failed.\n");
+        goto err_03;
+    }
+
+	alGenBuffers(result->buffer_count, result->buffers);
+	for (int i = 0; i < result->buffer_count; ++i)
 	{
-		ALuint buffer;
-		alGenBuffers((ALuint)1, &buffer);
-		alBufferData(buffer, AL_FORMAT_STEREO16, NULL, 0, frequency);
-		alSourceQueueBuffers(result->source, 1, &buffer);
+		alBufferData(result->buffers[i], AL_FORMAT_STEREO16, NULL, 0, result->frequency);
+		alSourceQueueBuffers(result->source, 1, &result->buffers[i]);
+		result->queued_frames[i] = 0;
 	}
 
 	alSourcePlay(result->source);
 
+    go2_audio_events_enable(result);
+
+    if (alIsExtensionPresent("AL_SOFT_source_latency"))
+    {
+        result->get_source_i64v = (go2_al_get_source_i64v_t)alGetProcAddress("alGetSourcei64vSOFT");
+    }
+
+    return 0;
+
+
+err_03:
+    free(result->buffers);
+    free(result->queued_frames);
+    alDeleteSources(1, &result->source);
+    alcMakeContextCurrent(NULL);
+    alcDestroyContext(result->context);
+
+err_02:
+    alcCloseDevice(result->device);
+
+err_01:
+    close(result->event_fd);
+
+err_00:
+    return -1;
+}
+
+static void go2_audio_openal_destroy(go2_audio_t* audio, bool drain)
+{
+    while (drain && alcMakeContextCurrent(audio->context))
+    {
+        ALint state;
+        alGetSourcei(audio->source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING) break;
+
+        usleep(AUDIO_POLL_MAX_MS * 1000);
+    }
+
+    go2_audio_events_disable(audio);
+
+    alDeleteSources(1, &audio->source);
+    alDeleteBuffers(audio->buffer_count, audio->buffers);
+    alcDestroyContext(audio->context);
+    alcCloseDevice(audio->device);
+
+    close(audio->event_fd);
+
+    free(audio->buffers);
+    free(audio->queued_frames);
+}
+
+static int go2_audio_openal_submit(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    if (!alcMakeContextCurrent(audio->context))
+    {
+        printf("alcMakeContextCurrent failed.\n");
+        return -1;
+    }
+
+    int ret = go2_audio_buffer_wait(audio, timeout_ms);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    pthread_mutex_lock(&audio->position_mutex);
+
+    ALuint openALBufferID;
+    alSourceUnqueueBuffers(audio->source, 1, &openALBufferID);
+
+    ALuint format = AL_FORMAT_STEREO16;
+
+    int dataByteLength = frames * sizeof(short) * SOUND_CHANNEL_COUNT;
+    alBufferData(openALBufferID, format, data, dataByteLength, audio->frequency);
+
+    alSourceQueueBuffers(audio->source, 1, &openALBufferID);
+
+    audio->frames_unqueued += audio->queued_frames[audio->queue_head];
+    audio->queued_frames[audio->queue_head] = frames;
+    audio->queue_head = (audio->queue_head + 1) % audio->buffer_count;
+    audio->frames_written += frames;
+
+    pthread_mutex_unlock(&audio->position_mutex);
+
+    audio->last_frames = frames;
+
+    ALint result;
+    alGetSourcei(audio->source, AL_SOURCE_STATE, &result);
+
+    if (result != AL_PLAYING)
+    {
+        alSourcePlay(audio->source);
+    }
+
+    return frames;
+}
+
+
+static int go2_audio_alsa_create(go2_audio_t* result, const go2_audio_attributes_t* attributes)
+{
+    const char* device = attributes->device ? attributes->device : ALSA_DEFAULT_DEVICE;
+
+    int err = snd_pcm_open(&result->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0)
+    {
+        printf("snd_pcm_open failed (%s).\n", snd_strerror(err));
+        goto err_00;
+    }
+
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_hw_params_alloca(&hw);
+
+    if (snd_pcm_hw_params_any(result->pcm, hw) < 0 ||
+        snd_pcm_hw_params_set_access(result->pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0 ||
+        snd_pcm_hw_params_set_format(result->pcm, hw, SND_PCM_FORMAT_S16_LE) < 0 ||
+        snd_pcm_hw_params_set_channels(result->pcm, hw, SOUND_CHANNEL_COUNT) < 0)
+    {
+        printf("snd_pcm_hw_params failed (mmap S16_LE stereo not supported).\n");
+        goto err_01;
+    }
+
+    unsigned int rate = result->frequency;
+    snd_pcm_uframes_t period = result->period_frames;
+    unsigned int periods = attributes->period_count ? attributes->period_count : ALSA_PERIOD_COUNT;
+
+    if (snd_pcm_hw_params_set_rate_near(result->pcm, hw, &rate, NULL) < 0 ||
+        snd_pcm_hw_params_set_period_size_near(result->pcm, hw, &period, NULL) < 0 ||
+        snd_pcm_hw_params_set_periods_near(result->pcm, hw, &periods, NULL) < 0)
+    {
+        printf("snd_pcm_hw_params failed (rate/period).\n");
+        goto err_01;
+    }
+
+    err = snd_pcm_hw_params(result->pcm, hw);
+    if (err < 0)
+    {
+        printf("snd_pcm_hw_params failed (%s).\n", snd_strerror(err));
+        goto err_01;
+    }
+
+    // Position and rate control must use the rate the device really runs at.
+    if (rate != (unsigned int)result->frequency)
+    {
+        printf("audio: %s runs at %u Hz instead of %d Hz.\n", device, rate, result->frequency);
+        result->frequency = (int)rate;
+    }
+
+    snd_pcm_uframes_t buffer;
+    snd_pcm_hw_params_get_period_size(hw, &period, NULL);
+    snd_pcm_hw_params_get_buffer_size(hw, &buffer);
+
+    result->period_frames = (int)period;
+    result->buffer_frames = (int)buffer;
+
+    // The stream is started explicitly once the ring is nearly full; writes
+    // through mmap_commit do not trigger the automatic start.
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_sw_params_alloca(&sw);
+
+    if (snd_pcm_sw_params_current(result->pcm, sw) < 0 ||
+        snd_pcm_sw_params_set_start_threshold(result->pcm, sw, buffer) < 0 ||
+        snd_pcm_sw_params_set_avail_min(result->pcm, sw, period) < 0 ||
+        snd_pcm_sw_params(result->pcm, sw) < 0)
+    {
+        printf("snd_pcm_sw_params failed.\n");
+        goto err_01;
+    }
+
+    err = snd_pcm_prepare(result->pcm);
+    if (err < 0)
+    {
+        printf("snd_pcm_prepare failed (%s).\n", snd_strerror(err));
+        goto err_01;
+    }
+
+    return 0;
+
+
+err_01:
+    snd_pcm_close(result->pcm);
+
+err_00:
+    return -1;
+}
+
+static void go2_audio_alsa_destroy(go2_audio_t* audio, bool drain)
+{
+    if (drain)
+    {
+        snd_pcm_drain(audio->pcm);
+    }
+    else
+    {
+        snd_pcm_drop(audio->pcm);
+    }
+
+    snd_pcm_close(audio->pcm);
+}
+
+// Starts playback once all but one period of the ring is queued.
+static int go2_audio_alsa_start(go2_audio_t* audio, snd_pcm_sframes_t avail)
+{
+    if (snd_pcm_state(audio->pcm) != SND_PCM_STATE_PREPARED)
+    {
+        return 0;
+    }
+
+    if (audio->buffer_frames - avail < audio->buffer_frames - audio->period_frames)
+    {
+        return 0;
+    }
+
+    return snd_pcm_start(audio->pcm);
+}
+
+static int go2_audio_alsa_submit(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int written = 0;
+
+    while (written < frames)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(audio->pcm);
+        if (avail < 0)
+        {
+            if (snd_pcm_recover(audio->pcm, (int)avail, 1) < 0)
+            {
+                printf("snd_pcm_recover failed (%s).\n", snd_strerror((int)avail));
+                return -1;
+            }
+
+            continue;
+        }
+
+        if (avail == 0)
+        {
+            // A full ring always satisfies the start condition.
+            if (go2_audio_alsa_start(audio, avail) < 0)
+            {
+                printf("snd_pcm_start failed.\n");
+                return -1;
+            }
+
+            int wait_ms = -1;
+            if (timeout_ms >= 0)
+            {
+                wait_ms = timeout_ms - go2_audio_elapsed_ms(&start);
+                if (wait_ms <= 0)
+                {
+                    break;
+                }
+            }
+
+            int err = snd_pcm_wait(audio->pcm, wait_ms);
+            if (err < 0 && snd_pcm_recover(audio->pcm, err, 1) < 0)
+            {
+                printf("snd_pcm_wait failed (%s).\n", snd_strerror(err));
+                return -1;
+            }
+
+            continue;
+        }
+
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t count = frames - written;
+
+        int err = snd_pcm_mmap_begin(audio->pcm, &areas, &offset, &count);
+        if (err < 0)
+        {
+            if (snd_pcm_recover(audio->pcm, err, 1) < 0)
+            {
+                printf("snd_pcm_mmap_begin failed (%s).\n", snd_strerror(err));
+                return -1;
+            }
+
+            continue;
+        }
+
+        // Interleaved access: every channel shares the first area.
+        uint8_t* dst = (uint8_t*)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+        memcpy(dst, data + written * SOUND_CHANNEL_COUNT, count * sizeof(short) * SOUND_CHANNEL_COUNT);
+
+        pthread_mutex_lock(&audio->position_mutex);
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(audio->pcm, offset, count);
+        if (committed > 0)
+        {
+            audio->frames_written += committed;
+        }
+
+        pthread_mutex_unlock(&audio->position_mutex);
+
+        if (committed < 0 || (snd_pcm_uframes_t)committed != count)
+        {
+            if (snd_pcm_recover(audio->pcm, committed < 0 ? (int)committed : -EPIPE, 1) < 0)
+            {
+                printf("snd_pcm_mmap_commit failed.\n");
+                return -1;
+            }
+
+            continue;
+        }
+
+        written += (int)count;
+
+        if (go2_audio_alsa_start(audio, avail - (snd_pcm_sframes_t)count) < 0)
+        {
+            printf("snd_pcm_start failed.\n");
+            return -1;
+        }
+    }
+
+    return written;
+}
+
+
+static int go2_audio_backend_submit(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    if (audio->backend == GO2_AUDIO_BACKEND_ALSA)
+    {
+        return go2_audio_alsa_submit(audio, data, frames, timeout_ms);
+    }
+
+    return go2_audio_openal_submit(audio, data, frames, timeout_ms);
+}
+
+
+static int go2_audio_ring_block_index(go2_audio_t* audio, const short* block)
+{
+    return (int)((block - audio->ring_memory) / (audio->ring_block_frames * SOUND_CHANNEL_COUNT));
+}
+
+// Hands the partial block to the feeder. Called with ring_partial_mutex held.
+static void go2_audio_ring_partial_push(go2_audio_t* audio)
+{
+    if (!audio->ring_partial || audio->ring_partial_frames == 0)
+    {
+        return;
+    }
+
+    audio->ring_block_lengths[go2_audio_ring_block_index(audio, audio->ring_partial)] = audio->ring_partial_frames;
+    go2_spsc_queue_push(audio->ring_filled, audio->ring_partial, 0);
+
+    audio->ring_partial = NULL;
+    audio->ring_partial_frames = 0;
+}
+
+// Takes the caller's partial block once nothing else is queued, so the tail
+// of a stream is played even if no further submit completes the block.
+static short* go2_audio_ring_partial_take(go2_audio_t* audio, int* frames)
+{
+    short* block = NULL;
+
+    pthread_mutex_lock(&audio->ring_partial_mutex);
+
+    // Blocks pushed since the pop timed out are older than the partial one.
+    if (audio->ring_partial && audio->ring_partial_frames > 0 &&
+        go2_spsc_queue_count_get(audio->ring_filled) == 0)
+    {
+        block = audio->ring_partial;
+        *frames = audio->ring_partial_frames;
+
+        audio->ring_partial = NULL;
+        audio->ring_partial_frames = 0;
+    }
+
+    pthread_mutex_unlock(&audio->ring_partial_mutex);
+
+    return block;
+}
+
+static void* go2_audio_feeder(void* arg)
+{
+    go2_audio_t* audio = (go2_audio_t*)arg;
+
+    while (true)
+    {
+        short* block;
+        int frames;
+
+        void* value;
+        if (go2_spsc_queue_pop(audio->ring_filled, &value, FEEDER_POLL_MS))
+        {
+            block = go2_audio_ring_partial_take(audio, &frames);
+            if (!block)
+            {
+                if (audio->terminating) break;
+                continue;
+            }
+        }
+        else
+        {
+            block = (short*)value;
+            frames = audio->ring_block_lengths[go2_audio_ring_block_index(audio, block)];
+        }
+
+        if (go2_audio_backend_submit(audio, block, frames, -1) < 0)
+        {
+            printf("audio feeder: submit failed.\n");
+        }
+
+        atomic_fetch_sub(&audio->ring_level, frames);
+        go2_spsc_queue_push(audio->ring_free, block, -1);
+    }
+
+    return NULL;
+}
+
+static void go2_audio_ring_destroy(go2_audio_t* audio)
+{
+    if (audio->ring_free) go2_spsc_queue_destroy(audio->ring_free);
+    if (audio->ring_filled) go2_spsc_queue_destroy(audio->ring_filled);
+
+    free(audio->ring_memory);
+    free(audio->ring_block_lengths);
+    pthread_mutex_destroy(&audio->ring_partial_mutex);
+
+    audio->ring_free = NULL;
+    audio->ring_filled = NULL;
+    audio->ring_memory = NULL;
+    audio->ring_block_lengths = NULL;
+}
+
+static int go2_audio_ring_create(go2_audio_t* audio, int ringFrames, int blockFrames)
+{
+    int blockCount = (ringFrames + blockFrames - 1) / blockFrames;
+    if (blockCount < RING_BLOCK_COUNT_MIN) blockCount = RING_BLOCK_COUNT_MIN;
+
+    audio->ring_block_frames = blockFrames;
+    audio->ring_block_count = blockCount;
+
+    pthread_mutex_init(&audio->ring_partial_mutex, NULL);
+
+    audio->ring_memory = malloc((size_t)blockCount * blockFrames * sizeof(short) * SOUND_CHANNEL_COUNT);
+    audio->ring_block_lengths = malloc(blockCount * sizeof(int));
+    if (!audio->ring_memory || !audio->ring_block_lengths)
+    {
+        printf("malloc failed.\n");
+        goto err_00;
+    }
+
+    audio->ring_free = go2_spsc_queue_create(blockCount);
+    audio->ring_filled = go2_spsc_queue_create(blockCount);
+    if (!audio->ring_free || !audio->ring_filled)
+    {
+        goto err_00;
+    }
+
+    for (int i = 0; i < blockCount; ++i)
+    {
+        go2_spsc_queue_push(audio->ring_free, audio->ring_memory + (size_t)i * blockFrames * SOUND_CHANNEL_COUNT, 0);
+    }
+
+    atomic_init(&audio->ring_level, 0);
+
+    if (pthread_create(&audio->feeder_thread, NULL, go2_audio_feeder, audio))
+    {
+        printf("pthread_create failed.\n");
+        goto err_00;
+    }
+
+    return 0;
+
+
+err_00:
+    go2_audio_ring_destroy(audio);
+    return -1;
+}
+
+// Copies as much of data into the ring as fits before the timeout. Complete
+// blocks are handed to the feeder; the feeder takes a partial block itself
+// once it has been idle for FEEDER_POLL_MS.
+static int go2_audio_ring_write(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int written = 0;
+
+    pthread_mutex_lock(&audio->ring_partial_mutex);
+
+    while (written < frames)
+    {
+        if (!audio->ring_partial)
+        {
+            int wait_ms = timeout_ms;
+            if (timeout_ms > 0)
+            {
+                wait_ms = timeout_ms - go2_audio_elapsed_ms(&start);
+                if (wait_ms < 0) wait_ms = 0;
+            }
+
+            // Never block with the mutex held; an idle feeder takes it.
+            void* value;
+            pthread_mutex_unlock(&audio->ring_partial_mutex);
+            int err = go2_spsc_queue_pop(audio->ring_free, &value, wait_ms);
+            pthread_mutex_lock(&audio->ring_partial_mutex);
+
+            if (err)
+            {
+                break;
+            }
+
+            audio->ring_partial = (short*)value;
+            audio->ring_partial_frames = 0;
+        }
+
+        int count = audio->ring_block_frames - audio->ring_partial_frames;
+        if (count > frames - written) count = frames - written;
+
+        memcpy(audio->ring_partial + audio->ring_partial_frames * SOUND_CHANNEL_COUNT,
+               data + written * SOUND_CHANNEL_COUNT,
+               count * sizeof(short) * SOUND_CHANNEL_COUNT);
+
+        audio->ring_partial_frames += count;
+        written += count;
+
+        atomic_fetch_add(&audio->ring_level, count);
+
+        if (audio->ring_partial_frames == audio->ring_block_frames)
+        {
+            go2_audio_ring_partial_push(audio);
+        }
+    }
+
+    pthread_mutex_unlock(&audio->ring_partial_mutex);
+
+    return written;
+}
+
+
+go2_audio_t* go2_audio_create_ex(const go2_audio_attributes_t* attributes)
+{
+    go2_audio_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        goto out;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->frequency = attributes->frequency;
+    result->backend = attributes->backend;
+    result->buffer_count = attributes->buffer_count ? attributes->buffer_count : OPENAL_BUFFER_COUNT;
+
+    if (result->buffer_count < 2 || result->buffer_count > OPENAL_BUFFER_COUNT_MAX)
+    {
+        printf("buffer_count must be between 2 and %d.\n", OPENAL_BUFFER_COUNT_MAX);
+        goto err_00;
+    }
+
+    // A latency target is split evenly across the backend's buffers.
+    result->period_frames = attributes->period_frames;
+    if (result->period_frames == 0 && attributes->latency_ms > 0)
+    {
+        int periodCount = result->buffer_count;
+        if (result->backend == GO2_AUDIO_BACKEND_ALSA)
+        {
+            periodCount = attributes->period_count ? attributes->period_count : ALSA_PERIOD_COUNT;
+        }
+
+        result->period_frames = attributes->latency_ms * result->frequency / 1000 / periodCount;
+        if (result->period_frames < 1) result->period_frames = 1;
+    }
+
+    if (result->period_frames == 0)
+    {
+        result->period_frames = AUDIO_PERIOD_FRAMES;
+    }
+
+    pthread_mutex_init(&result->position_mutex, NULL);
+    atomic_init(&result->frames_submitted, 0);
+
+    int err;
+    switch (result->backend)
+    {
+        case GO2_AUDIO_BACKEND_OPENAL:
+            err = go2_audio_openal_create(result);
+            break;
+
+        case GO2_AUDIO_BACKEND_ALSA:
+            err = go2_audio_alsa_create(result, attributes);
+            break;
+
+        default:
+            printf("invalid audio backend.\n");
+            err = -1;
+            break;
+    }
+
+    if (err)
+    {
+        goto err_00;
+    }
+
+    if (attributes->resampler != GO2_AUDIO_RESAMPLER_NONE)
+    {
+        int sourceFrequency = attributes->source_frequency ? attributes->source_frequency : attributes->frequency;
+
+        result->rate_nominal = (double)result->frequency / sourceFrequency;
+        result->rate_delta = attributes->max_rate_delta > 0 ? attributes->max_rate_delta : RATE_DELTA_DEFAULT;
+        result->rate_fill = 0.5;
+
+        go2_resampler_quality_t quality = (attributes->resampler == GO2_AUDIO_RESAMPLER_SINC) ?
+            GO2_RESAMPLER_SINC : GO2_RESAMPLER_LINEAR;
+
+        result->resampler = go2_resampler_create(quality, result->rate_nominal);
+        if (!result->resampler)
+        {
+            goto err_01;
+        }
+    }
+
+    if (attributes->ring_frames > 0)
+    {
+        if (go2_audio_ring_create(result, attributes->ring_frames, result->period_frames))
+        {
+            goto err_02;
+        }
+    }
+
     result->isAudioInitialized = true;
 
     // testing
@@ -106,66 +950,311 @@ go2_audio_t* go2_audio_create(int frequency)
     return result;
 
 
+err_02:
+    if (result->resampler) go2_resampler_destroy(result->resampler);
+
 err_01:
-    alcCloseDevice(result->device);
+    if (result->backend == GO2_AUDIO_BACKEND_ALSA)
+    {
+        go2_audio_alsa_destroy(result, false);
+    }
+    else
+    {
+        go2_audio_openal_destroy(result, false);
+    }
 
 err_00:
+    pthread_mutex_destroy(&result->position_mutex);
     free(result);
 
 out:
     return NULL;
 }
 
+go2_audio_t* go2_audio_create(int frequency)
+{
+    go2_audio_attributes_t attributes = { 0 };
+    attributes.frequency = frequency;
+    attributes.backend = GO2_AUDIO_BACKEND_OPENAL;
+
+    return go2_audio_create_ex(&attributes);
+}
+
 void go2_audio_destroy(go2_audio_t* audio)
 {
-    alDeleteSources(1, &audio->source);
-    alcDestroyContext(audio->context);
-    alcCloseDevice(audio->device);
+    bool drain = audio->ring_memory != NULL;
+
+    if (audio->ring_memory)
+    {
+        // Everything still in the ring, including a partial block, is
+        // handed to the backend before the feeder exits.
+        go2_audio_flush(audio);
+
+        audio->terminating = true;
+        pthread_join(audio->feeder_thread, NULL);
+        go2_audio_ring_destroy(audio);
+    }
+
+    if (audio->backend == GO2_AUDIO_BACKEND_ALSA)
+    {
+        go2_audio_alsa_destroy(audio, drain);
+    }
+    else
+    {
+        go2_audio_openal_destroy(audio, drain);
+    }
+
+    if (audio->resampler)
+    {
+        go2_resampler_destroy(audio->resampler);
+        free(audio->resample_buffer);
+    }
 
+    pthread_mutex_destroy(&audio->position_mutex);
     free(audio);
 }
 
-void go2_audio_submit(go2_audio_t* audio, const short* data, int frames)
+static int go2_audio_output_submit(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
 {
-    if (!audio || !audio->isAudioInitialized) return;
+    int result;
+    if (audio->ring_memory)
+    {
+        result = go2_audio_ring_write(audio, data, frames, timeout_ms);
+    }
+    else
+    {
+        result = go2_audio_backend_submit(audio, data, frames, timeout_ms);
+    }
 
+    if (result > 0)
+    {
+        atomic_fetch_add(&audio->frames_submitted, result);
+    }
 
-    if (!alcMakeContextCurrent(audio->context))
+    return result;
+}
+
+// Steers the ratio from the smoothed output fill level: a full queue slows
+// the output down, an empty one speeds it up, by at most rate_delta.
+static void go2_audio_rate_update(go2_audio_t* audio)
+{
+    double fill;
+    if (audio->ring_memory)
     {
-        printf("alcMakeContextCurrent failed.\n");
-        return;
+        fill = (double)go2_audio_ring_level_get(audio) / go2_audio_ring_capacity_get(audio);
+    }
+    else
+    {
+        go2_audio_position_t position;
+        go2_audio_position_get(audio, &position);
+
+        // OpenAL queues one buffer per submit, so its capacity follows the
+        // size of the chunks actually being submitted.
+        int capacity = audio->buffer_frames;
+        if (audio->backend == GO2_AUDIO_BACKEND_OPENAL)
+        {
+            int frames = audio->last_frames ? audio->last_frames : audio->period_frames;
+            capacity = audio->buffer_count * frames;
+        }
+
+        fill = (double)position.frames_queued / capacity;
     }
 
-    ALint processed = 0;
-    while(!processed)
+    if (fill > 1.0) fill = 1.0;
+
+    // The instantaneous level jumps by a whole buffer per submit or
+    // period; an exponential moving average keeps pitch changes smooth.
+    audio->rate_fill += RATE_FILL_SMOOTHING * (fill - audio->rate_fill);
+
+    double ratio = audio->rate_nominal * (1.0 + audio->rate_delta * (1.0 - 2.0 * audio->rate_fill));
+    go2_resampler_ratio_set(audio->resampler, ratio);
+}
+
+// Input is accepted whole once any output left over from an earlier
+// timed-out call has been flushed.
+static int go2_audio_resample_submit(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (audio->resample_pending > 0)
     {
-        alGetSourceiv(audio->source, AL_BUFFERS_PROCESSED, &processed);
+        int ret = go2_audio_output_submit(audio, audio->resample_buffer + audio->resample_offset * SOUND_CHANNEL_COUNT,
+                                          audio->resample_pending, timeout_ms);
+        if (ret < 0) return -1;
+
+        audio->resample_offset += ret;
+        audio->resample_pending -= ret;
+        if (audio->resample_pending > 0) return 0;
+    }
 
-        if (!processed)
+    go2_audio_rate_update(audio);
+
+    int capacity = go2_resampler_output_max(audio->resampler, frames);
+    if (capacity > audio->resample_capacity)
+    {
+        short* buffer = realloc(audio->resample_buffer, capacity * sizeof(short) * SOUND_CHANNEL_COUNT);
+        if (!buffer)
         {
-            sleep(0);
-            //printf("Audio overflow.\n");
-            //return;
+            printf("malloc failed.\n");
+            return -1;
         }
+
+        audio->resample_buffer = buffer;
+        audio->resample_capacity = capacity;
     }
 
-    ALuint openALBufferID;
-    alSourceUnqueueBuffers(audio->source, 1, &openALBufferID);
+    int count = go2_resampler_process(audio->resampler, data, frames, audio->resample_buffer, capacity);
+    if (count < 0) return -1;
 
-    ALuint format = AL_FORMAT_STEREO16;
+    audio->resample_offset = 0;
+    audio->resample_pending = count;
 
-    int dataByteLength = frames * sizeof(short) * SOUND_CHANNEL_COUNT;
-    alBufferData(openALBufferID, format, data, dataByteLength, audio->frequency);
+    int wait_ms = timeout_ms;
+    if (timeout_ms > 0)
+    {
+        wait_ms = timeout_ms - go2_audio_elapsed_ms(&start);
+        if (wait_ms < 0) wait_ms = 0;
+    }
 
-    alSourceQueueBuffers(audio->source, 1, &openALBufferID);
+    int ret = go2_audio_output_submit(audio, audio->resample_buffer, count, wait_ms);
+    if (ret < 0) return -1;
 
-    ALint result;
-    alGetSourcei(audio->source, AL_SOURCE_STATE, &result);
+    audio->resample_offset = ret;
+    audio->resample_pending -= ret;
 
-    if (result != AL_PLAYING)
+    return frames;
+}
+
+int go2_audio_submit_timeout(go2_audio_t* audio, const short* data, int frames, int timeout_ms)
+{
+    if (!audio || !audio->isAudioInitialized) return -1;
+
+
+    if (audio->resampler)
     {
-        alSourcePlay(audio->source);
+        return go2_audio_resample_submit(audio, data, frames, timeout_ms);
+    }
+
+    return go2_audio_output_submit(audio, data, frames, timeout_ms);
+}
+
+void go2_audio_submit(go2_audio_t* audio, const short* data, int frames)
+{
+    go2_audio_submit_timeout(audio, data, frames, -1);
+}
+
+void go2_audio_flush(go2_audio_t* audio)
+{
+    if (!audio->ring_memory)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&audio->ring_partial_mutex);
+    go2_audio_ring_partial_push(audio);
+    pthread_mutex_unlock(&audio->ring_partial_mutex);
+}
+
+int go2_audio_ring_level_get(go2_audio_t* audio)
+{
+    if (!audio->ring_memory) return 0;
+
+    return atomic_load_explicit(&audio->ring_level, memory_order_relaxed);
+}
+
+int go2_audio_ring_capacity_get(go2_audio_t* audio)
+{
+    return audio->ring_block_count * audio->ring_block_frames;
+}
+
+int go2_audio_frequency_get(go2_audio_t* audio)
+{
+    return audio->frequency;
+}
+
+// Frames that have left the OpenAL source, less the device latency when
+// AL_SOFT_source_latency is available.
+static uint64_t go2_audio_openal_played_get(go2_audio_t* audio)
+{
+    ALint state;
+    alGetSourcei(audio->source, AL_SOURCE_STATE, &state);
+
+    if (state != AL_PLAYING)
+    {
+        // Stopped on underrun: every buffer still queued has been played.
+        return audio->frames_written;
+    }
+
+    // Sample offsets count from the oldest buffer still queued.
+    uint64_t result = audio->frames_unqueued;
+
+    if (audio->get_source_i64v)
+    {
+        int64_t values[2];
+        audio->get_source_i64v(audio->source, AL_SAMPLE_OFFSET_LATENCY_SOFT, values);
+
+        int64_t offset = values[0] >> 32;
+        int64_t latency = values[1] * audio->frequency / 1000000000LL;
+
+        result += (offset > latency) ? (uint64_t)(offset - latency) : 0;
+    }
+    else
+    {
+        ALint offset;
+        alGetSourcei(audio->source, AL_SAMPLE_OFFSET, &offset);
+        result += offset;
+    }
+
+    return result;
+}
+
+static uint64_t go2_audio_alsa_played_get(go2_audio_t* audio)
+{
+    // The delay covers the ring plus the hardware latency.
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay(audio->pcm, &delay) < 0 || delay < 0)
+    {
+        return audio->frames_written;
     }
+
+    return ((uint64_t)delay < audio->frames_written) ? audio->frames_written - delay : 0;
+}
+
+int go2_audio_position_get(go2_audio_t* audio, go2_audio_position_t* position)
+{
+    memset(position, 0, sizeof(*position));
+
+    if (!audio || !audio->isAudioInitialized) return -1;
+
+
+    struct timespec now;
+
+    pthread_mutex_lock(&audio->position_mutex);
+
+    uint64_t played;
+    if (audio->backend == GO2_AUDIO_BACKEND_ALSA)
+    {
+        played = go2_audio_alsa_played_get(audio);
+    }
+    else
+    {
+        played = go2_audio_openal_played_get(audio);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_unlock(&audio->position_mutex);
+
+    uint64_t submitted = atomic_load(&audio->frames_submitted);
+    if (played > submitted) played = submitted;
+
+    position->frames_played = played;
+    position->frames_queued = submitted - played;
+    position->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec +
+        position->frames_queued * 1000000000ULL / audio->frequency;
+
+    return 0;
 }
 
 uint32_t go2_audio_volume_get(go2_audio_t* audio)
@@ -34,14 +34,67 @@ typedef enum
     Audio_Path_MAX = 0x7fffffff
 } go2_audio_path_t;
 
+typedef enum go2_audio_backend
+{
+    GO2_AUDIO_BACKEND_OPENAL = 0,
+    GO2_AUDIO_BACKEND_ALSA      // mmap directly into the PCM ring
+} go2_audio_backend_t;
+
+typedef enum go2_audio_resampler
+{
+    GO2_AUDIO_RESAMPLER_NONE = 0,
+    GO2_AUDIO_RESAMPLER_LINEAR,
+    GO2_AUDIO_RESAMPLER_SINC
+} go2_audio_resampler_t;
+
+typedef struct go2_audio_attributes
+{
+    int frequency;
+    go2_audio_backend_t backend;
+    const char* device;         // ALSA PCM name, NULL = "default"
+    int period_frames;          // ALSA period / ring block size, 0 = default
+    int period_count;           // ALSA only, 0 = default
+    int ring_frames;            // > 0 = queue submits in a ring drained by a feeder thread
+    int latency_ms;             // sizes periods when period_frames is 0, 0 = default
+    int buffer_count;           // OpenAL buffers, 0 = default
+    go2_audio_resampler_t resampler;    // dynamic rate control on submit
+    int source_frequency;       // rate of submitted audio, 0 = frequency
+    float max_rate_delta;       // largest ratio adjustment, 0 = 0.005
+} go2_audio_attributes_t;
+
+typedef struct go2_audio_position
+{
+    uint64_t frames_played;     // frames that have reached the output
+    uint64_t frames_queued;     // accepted by submit but not yet played
+    uint64_t timestamp_ns;      // CLOCK_MONOTONIC estimate of when the queue runs dry
+} go2_audio_position_t;
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 go2_audio_t* go2_audio_create(int frequency);
+go2_audio_t* go2_audio_create_ex(const go2_audio_attributes_t* attributes);
 void go2_audio_destroy(go2_audio_t* audio);
 void go2_audio_submit(go2_audio_t* audio, const short* data, int frames);
+
+// Returns the number of frames accepted (0 on timeout) or -1 on error.
+// timeout_ms: 0 = do not wait, -1 = wait forever.
+int go2_audio_submit_timeout(go2_audio_t* audio, const short* data, int frames, int timeout_ms);
+
+// Hands a partially filled ring block to the backend without waiting for
+// the feeder to sit idle for 100 ms. Does nothing without a ring.
+void go2_audio_flush(go2_audio_t* audio);
+
+// Lock-free fill level of the submit ring, in frames (0 without a ring).
+int go2_audio_ring_level_get(go2_audio_t* audio);
+int go2_audio_ring_capacity_get(go2_audio_t* audio);
+
+// Output rate in use; ALSA may pick a different rate than requested.
+int go2_audio_frequency_get(go2_audio_t* audio);
+
+int go2_audio_position_get(go2_audio_t* audio, go2_audio_position_t* position);
 uint32_t go2_audio_volume_get(go2_audio_t* audio);
 void go2_audio_volume_set(go2_audio_t* audio, uint32_t value);
 go2_audio_path_t go2_audio_path_get(go2_audio_t* audio);
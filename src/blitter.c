@@ -0,0 +1,684 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "blitter.h"
+#include "convert.h"
+
+#include <drm/drm_fourcc.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+typedef enum
+{
+    Layout_Unknown = 0,
+    Layout_RGBA8888,    // bytes: R G B A
+    Layout_RGBX8888,    // bytes: R G B X
+    Layout_BGRA8888,    // bytes: B G R A
+    Layout_RGB888,      // bytes: R G B
+    Layout_BGR888,      // bytes: B G R
+    Layout_RGB565,      // u16: RRRRRGGGGGGBBBBB
+    Layout_RGBA5551,    // u16: RRRRRGGGGGBBBBBA
+    Layout_RGBA4444,    // u16: RRRRGGGGBBBBAAAA
+    Layout_Convert      // any other format, converted by go2_convert
+} go2_layout_t;
+
+
+static go2_layout_t go2_layout_get(uint32_t format)
+{
+    switch (format)
+    {
+        case DRM_FORMAT_RGBA8888:
+            return Layout_RGBA8888;
+
+        case DRM_FORMAT_RGBX8888:
+            return Layout_RGBX8888;
+
+        case DRM_FORMAT_ARGB8888:
+        case DRM_FORMAT_XRGB8888:
+            return Layout_BGRA8888;
+
+        case DRM_FORMAT_RGB888:
+            return Layout_RGB888;
+
+        case DRM_FORMAT_BGR888:
+            return Layout_BGR888;
+
+        case DRM_FORMAT_RGB565:
+            return Layout_RGB565;
+
+        case DRM_FORMAT_RGBA5551:
+            return Layout_RGBA5551;
+
+        case DRM_FORMAT_RGBA4444:
+            return Layout_RGBA4444;
+
+        default:
+            return go2_convert_format_supported(format) ? Layout_Convert : Layout_Unknown;
+    }
+}
+
+static int go2_layout_bytes_per_pixel(go2_layout_t layout, uint32_t format)
+{
+    switch (layout)
+    {
+        case Layout_RGBA8888:
+        case Layout_RGBX8888:
+        case Layout_BGRA8888:
+            return 4;
+
+        case Layout_RGB888:
+        case Layout_BGR888:
+            return 3;
+
+        case Layout_RGB565:
+        case Layout_RGBA5551:
+        case Layout_RGBA4444:
+            return 2;
+
+        case Layout_Convert:
+            return go2_convert_format_bytes(format);
+
+        default:
+            return 0;
+    }
+}
+
+bool go2_blitter_sw_format_supported(uint32_t format)
+{
+    return go2_layout_get(format) != Layout_Unknown;
+}
+
+
+// Rows are converted through an intermediate 0xAARRGGBB representation,
+// which is DRM_FORMAT_ARGB8888 in memory.
+
+static void go2_row_unpack(go2_layout_t layout, uint32_t format, const uint8_t* src, uint32_t* argb, int count)
+{
+    const uint16_t* src16 = (const uint16_t*)src;
+
+    switch (layout)
+    {
+        case Layout_RGBA8888:
+            for (int i = 0; i < count; ++i, src += 4)
+                argb[i] = ((uint32_t)src[3] << 24) | ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+            break;
+
+        case Layout_RGBX8888:
+            for (int i = 0; i < count; ++i, src += 4)
+                argb[i] = 0xff000000 | ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+            break;
+
+        case Layout_BGRA8888:
+            memcpy(argb, src, count * 4);
+            break;
+
+        case Layout_RGB888:
+            for (int i = 0; i < count; ++i, src += 3)
+                argb[i] = 0xff000000 | ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+            break;
+
+        case Layout_BGR888:
+            for (int i = 0; i < count; ++i, src += 3)
+                argb[i] = 0xff000000 | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+            break;
+
+        case Layout_RGB565:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = src16[i];
+                uint32_t r = (p >> 11) & 0x1f;
+                uint32_t g = (p >> 5) & 0x3f;
+                uint32_t b = p & 0x1f;
+                argb[i] = 0xff000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+            }
+            break;
+
+        case Layout_RGBA5551:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = src16[i];
+                uint32_t r = (p >> 11) & 0x1f;
+                uint32_t g = (p >> 6) & 0x1f;
+                uint32_t b = (p >> 1) & 0x1f;
+                uint32_t a = (p & 1) ? 0xff : 0x00;
+                argb[i] = (a << 24) | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+            }
+            break;
+
+        case Layout_RGBA4444:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = src16[i];
+                uint32_t r = (p >> 12) & 0xf;
+                uint32_t g = (p >> 8) & 0xf;
+                uint32_t b = (p >> 4) & 0xf;
+                uint32_t a = p & 0xf;
+                argb[i] = ((a * 0x11) << 24) | ((r * 0x11) << 16) | ((g * 0x11) << 8) | (b * 0x11);
+            }
+            break;
+
+        case Layout_Convert:
+            go2_convert(src, 0, format, argb, 0, DRM_FORMAT_ARGB8888, count, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void go2_row_pack(go2_layout_t layout, uint32_t format, const uint32_t* argb, uint8_t* dst, int count)
+{
+    uint16_t* dst16 = (uint16_t*)dst;
+
+    switch (layout)
+    {
+        case Layout_RGBA8888:
+        case Layout_RGBX8888:
+            for (int i = 0; i < count; ++i, dst += 4)
+            {
+                uint32_t p = argb[i];
+                dst[0] = p >> 16;
+                dst[1] = p >> 8;
+                dst[2] = p;
+                dst[3] = (layout == Layout_RGBX8888) ? 0xff : (p >> 24);
+            }
+            break;
+
+        case Layout_BGRA8888:
+            memcpy(dst, argb, count * 4);
+            break;
+
+        case Layout_RGB888:
+            for (int i = 0; i < count; ++i, dst += 3)
+            {
+                uint32_t p = argb[i];
+                dst[0] = p >> 16;
+                dst[1] = p >> 8;
+                dst[2] = p;
+            }
+            break;
+
+        case Layout_BGR888:
+            for (int i = 0; i < count; ++i, dst += 3)
+            {
+                uint32_t p = argb[i];
+                dst[0] = p;
+                dst[1] = p >> 8;
+                dst[2] = p >> 16;
+            }
+            break;
+
+        case Layout_RGB565:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = argb[i];
+                dst16[i] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+            }
+            break;
+
+        case Layout_RGBA5551:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = argb[i];
+                dst16[i] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07c0) | ((p >> 2) & 0x003e) | (p >> 31);
+            }
+            break;
+
+        case Layout_RGBA4444:
+            for (int i = 0; i < count; ++i)
+            {
+                uint32_t p = argb[i];
+                dst16[i] = ((p >> 8) & 0xf000) | ((p >> 4) & 0x0f00) | (p & 0x00f0) | (p >> 28);
+            }
+            break;
+
+        case Layout_Convert:
+            go2_convert(argb, 0, DRM_FORMAT_ARGB8888, dst, 0, format, count, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Swaps the first and third byte of every 32 bit pixel, optionally forcing
+// the fourth byte to 0xff. Covers every conversion between the 8888 layouts.
+static void go2_row_swap_rb32(const uint8_t* src, uint8_t* dst, int count, bool opaque)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x4_t p = vld4q_u8(src + i * 4);
+        uint8x16_t t = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = t;
+        if (opaque) p.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + i * 4, p);
+    }
+#elif defined(__SSE2__)
+    const __m128i ag_mask = _mm_set1_epi32(0xff00ff00);
+    const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i a_mask = _mm_set1_epi32(opaque ? 0xff000000 : 0);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        __m128i ag = _mm_and_si128(p, ag_mask);
+        __m128i rb = _mm_and_si128(p, rb_mask);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_or_si128(ag, rb), a_mask));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const uint8_t* s = src + i * 4;
+        uint8_t* d = dst + i * 4;
+        uint8_t r = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = r;
+        d[3] = opaque ? 0xff : s[3];
+    }
+}
+
+// Drops the fourth byte of every 32 bit pixel, optionally swapping the first
+// and third. Covers every conversion from the 8888 layouts to RGB888/BGR888.
+static void go2_row_pack24(const uint8_t* src, uint8_t* dst, int count, bool swap)
+{
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x4_t p = vld4q_u8(src + i * 4);
+        uint8x16x3_t q;
+        q.val[0] = swap ? p.val[2] : p.val[0];
+        q.val[1] = p.val[1];
+        q.val[2] = swap ? p.val[0] : p.val[2];
+        vst3q_u8(dst + i * 3, q);
+    }
+#elif defined(__SSE2__)
+    const __m128i ag_mask = _mm_set1_epi32(0xff00ff00);
+    const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i lo_mask = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+    const __m128i hi_mask = _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        if (swap)
+        {
+            __m128i rb = _mm_and_si128(p, rb_mask);
+            rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+            p = _mm_or_si128(_mm_and_si128(p, ag_mask), rb);
+        }
+
+        // Close the gap inside each 64 bit half, then join the two 6 byte halves
+        __m128i t = _mm_or_si128(_mm_and_si128(p, lo_mask), _mm_srli_epi64(_mm_and_si128(p, hi_mask), 8));
+        __m128i r = _mm_or_si128(_mm_move_epi64(t), _mm_slli_si128(_mm_srli_si128(t, 8), 6));
+
+        _mm_storel_epi64((__m128i*)(dst + i * 3), r);
+        uint32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(r, 8));
+        memcpy(dst + i * 3 + 8, &tail, 4);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const uint8_t* s = src + i * 4;
+        uint8_t* d = dst + i * 3;
+        d[0] = swap ? s[2] : s[0];
+        d[1] = s[1];
+        d[2] = swap ? s[0] : s[2];
+    }
+}
+
+static void go2_row_convert(go2_layout_t srcLayout, uint32_t srcFormat, const uint8_t* src,
+                            go2_layout_t dstLayout, uint32_t dstFormat, uint8_t* dst, int count, uint32_t* scratch)
+{
+    // go2_convert handles every pair in one pass, including the native layouts
+    if (srcLayout == Layout_Convert || dstLayout == Layout_Convert)
+    {
+        go2_convert(src, 0, srcFormat, dst, 0, dstFormat, count, 1);
+        return;
+    }
+
+    if (srcLayout == dstLayout)
+    {
+        memcpy(dst, src, count * go2_layout_bytes_per_pixel(srcLayout, srcFormat));
+        return;
+    }
+
+    bool src32 = (srcLayout == Layout_RGBA8888 || srcLayout == Layout_RGBX8888);
+    bool dst32 = (dstLayout == Layout_RGBA8888 || dstLayout == Layout_RGBX8888);
+
+    if ((src32 && dstLayout == Layout_BGRA8888) || (srcLayout == Layout_BGRA8888 && dst32))
+    {
+        go2_row_swap_rb32(src, dst, count, srcLayout == Layout_RGBX8888 || dstLayout == Layout_RGBX8888);
+        return;
+    }
+
+    if ((src32 || srcLayout == Layout_BGRA8888) && (dstLayout == Layout_RGB888 || dstLayout == Layout_BGR888))
+    {
+        go2_row_pack24(src, dst, count, src32 != (dstLayout == Layout_RGB888));
+        return;
+    }
+
+    if (src32 && dst32)
+    {
+        // RGBA <-> RGBX
+        memcpy(dst, src, count * 4);
+        if (srcLayout == Layout_RGBX8888 || dstLayout == Layout_RGBX8888)
+        {
+            for (int i = 0; i < count; ++i) dst[i * 4 + 3] = 0xff;
+        }
+        return;
+    }
+
+    go2_row_unpack(srcLayout, srcFormat, src, scratch, count);
+    go2_row_pack(dstLayout, dstFormat, scratch, dst, count);
+}
+
+
+static void go2_fill_row32(uint8_t* dst, int count, uint32_t value)
+{
+    uint32_t* dst32 = (uint32_t*)dst;
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    uint32x4_t v = vdupq_n_u32(value);
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_u32(dst32 + i, v);
+    }
+#elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi32(value);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_si128((__m128i*)(dst32 + i), v);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        dst32[i] = value;
+    }
+}
+
+int go2_blitter_sw_fill(uint8_t* dst, int dstStride, uint32_t dstFormat, int x, int y, int width, int height, uint32_t color)
+{
+    go2_layout_t layout = go2_layout_get(dstFormat);
+    if (layout == Layout_Unknown)
+    {
+        printf("go2_blitter_sw_fill: format not supported.\n");
+        return -1;
+    }
+
+    int bpp = go2_layout_bytes_per_pixel(layout, dstFormat);
+
+    // The color is written as a raw pixel value in the destination format,
+    // matching c_RkRgaColorFill.
+    for (int j = 0; j < height; ++j)
+    {
+        uint8_t* row = dst + (y + j) * dstStride + x * bpp;
+
+        switch (bpp)
+        {
+            case 4:
+                go2_fill_row32(row, width, color);
+                break;
+
+            case 2:
+            {
+                uint16_t* row16 = (uint16_t*)row;
+                int i = 0;
+
+                if (((uintptr_t)row16 & 2) && width > 0)
+                {
+                    row16[i++] = (uint16_t)color;
+                }
+
+                int pairs = (width - i) / 2;
+                go2_fill_row32((uint8_t*)(row16 + i), pairs, (color & 0xffff) | (color << 16));
+                i += pairs * 2;
+
+                if (i < width)
+                {
+                    row16[i] = (uint16_t)color;
+                }
+                break;
+            }
+
+            case 3:
+                for (int i = 0; i < width; ++i)
+                {
+                    row[i * 3 + 0] = color;
+                    row[i * 3 + 1] = color >> 8;
+                    row[i * 3 + 2] = color >> 16;
+                }
+                break;
+        }
+    }
+
+    return 0;
+}
+
+
+static void go2_gather(const uint8_t* base, ptrdiff_t step, int bpp, uint32_t start, uint32_t increment, uint8_t* dst, int count)
+{
+    uint32_t position = start;
+
+    switch (bpp)
+    {
+        case 4:
+            for (int i = 0; i < count; ++i, position += increment)
+                memcpy(dst + i * 4, base + (ptrdiff_t)(position >> 16) * step, 4);
+            break;
+
+        case 3:
+            for (int i = 0; i < count; ++i, position += increment)
+                memcpy(dst + i * 3, base + (ptrdiff_t)(position >> 16) * step, 3);
+            break;
+
+        case 2:
+            for (int i = 0; i < count; ++i, position += increment)
+                memcpy(dst + i * 2, base + (ptrdiff_t)(position >> 16) * step, 2);
+            break;
+    }
+}
+
+static void go2_row_blend(const uint32_t* src, uint32_t* dst, int count, go2_blend_mode_t mode, uint32_t alpha)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        uint32_t s = src[i];
+        uint32_t d = dst[i];
+
+        uint32_t sa = ((s >> 24) * alpha + 127) / 255;
+        uint32_t inverse = 255 - sa;
+        uint32_t result = 0;
+
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t sc = (s >> shift) & 0xff;
+            uint32_t dc = (d >> shift) & 0xff;
+
+            uint32_t c = (mode == GO2_BLEND_SRC_OVER_PREMULTIPLIED) ?
+                (sc * alpha + dc * inverse + 127) / 255 :
+                (sc * sa + dc * inverse + 127) / 255;
+
+            result |= ((c > 255) ? 255 : c) << shift;
+        }
+
+        uint32_t da = d >> 24;
+        uint32_t a = sa + (da * inverse + 127) / 255;
+
+        dst[i] = result | (((a > 255) ? 255 : a) << 24);
+    }
+}
+
+static int go2_blit_rows(const uint8_t* src, int srcStride, uint32_t srcFormat, int srcX, int srcY, int srcWidth, int srcHeight,
+                         uint8_t* dst, int dstStride, uint32_t dstFormat, int dstX, int dstY, int dstWidth, int dstHeight,
+                         go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha)
+{
+    go2_layout_t srcLayout = go2_layout_get(srcFormat);
+    go2_layout_t dstLayout = go2_layout_get(dstFormat);
+    if (srcLayout == Layout_Unknown || dstLayout == Layout_Unknown)
+    {
+        printf("go2_blitter_sw_blit: format not supported.\n");
+        return -1;
+    }
+
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+    {
+        return 0;
+    }
+
+    int srcBpp = go2_layout_bytes_per_pixel(srcLayout, srcFormat);
+    int dstBpp = go2_layout_bytes_per_pixel(dstLayout, dstFormat);
+
+    // Size of the source rectangle once rotated into destination space
+    bool transposed = (rotation == GO2_ROTATION_DEGREES_90 || rotation == GO2_ROTATION_DEGREES_270);
+    int rotatedWidth = transposed ? srcHeight : srcWidth;
+    int rotatedHeight = transposed ? srcWidth : srcHeight;
+
+    // Fast path: plain copy / conversion of whole rows
+    if (blendMode == GO2_BLEND_NONE &&
+        rotation == GO2_ROTATION_DEGREES_0 && srcWidth == dstWidth && srcHeight == dstHeight)
+    {
+        uint32_t* scratch = malloc(dstWidth * sizeof(uint32_t));
+        if (!scratch)
+        {
+            printf("malloc failed.\n");
+            return -1;
+        }
+
+        for (int y = 0; y < dstHeight; ++y)
+        {
+            const uint8_t* srcRow = src + (srcY + y) * srcStride + srcX * srcBpp;
+            uint8_t* dstRow = dst + (dstY + y) * dstStride + dstX * dstBpp;
+
+            go2_row_convert(srcLayout, srcFormat, srcRow, dstLayout, dstFormat, dstRow, dstWidth, scratch);
+        }
+
+        free(scratch);
+        return 0;
+    }
+
+
+    // General path: nearest neighbour sampling. Each destination row maps to a
+    // line in the source that is walked with a 16.16 fixed point position.
+    uint8_t* gathered = malloc(dstWidth * 4);
+    uint32_t* scratch = malloc(dstWidth * sizeof(uint32_t));
+    uint32_t* background = (blendMode != GO2_BLEND_NONE) ? malloc(dstWidth * sizeof(uint32_t)) : NULL;
+    if (!gathered || !scratch || (blendMode != GO2_BLEND_NONE && !background))
+    {
+        printf("malloc failed.\n");
+        free(gathered);
+        free(scratch);
+        free(background);
+        return -1;
+    }
+
+    uint32_t xIncrement = ((uint64_t)rotatedWidth << 16) / dstWidth;
+    uint32_t yIncrement = ((uint64_t)rotatedHeight << 16) / dstHeight;
+    uint32_t yPosition = yIncrement >> 1;
+
+    for (int y = 0; y < dstHeight; ++y, yPosition += yIncrement)
+    {
+        int ry = yPosition >> 16;
+        const uint8_t* base;
+        ptrdiff_t step;
+
+        switch (rotation)
+        {
+            case GO2_ROTATION_DEGREES_90:
+                base = src + (srcY + srcHeight - 1) * srcStride + (srcX + ry) * srcBpp;
+                step = -srcStride;
+                break;
+
+            case GO2_ROTATION_DEGREES_180:
+                base = src + (srcY + srcHeight - 1 - ry) * srcStride + (srcX + srcWidth - 1) * srcBpp;
+                step = -srcBpp;
+                break;
+
+            case GO2_ROTATION_DEGREES_270:
+                base = src + srcY * srcStride + (srcX + srcWidth - 1 - ry) * srcBpp;
+                step = srcStride;
+                break;
+
+            case GO2_ROTATION_DEGREES_0:
+            default:
+                base = src + (srcY + ry) * srcStride + srcX * srcBpp;
+                step = srcBpp;
+                break;
+        }
+
+        go2_gather(base, step, srcBpp, xIncrement >> 1, xIncrement, gathered, dstWidth);
+
+        uint8_t* dstRow = dst + (dstY + y) * dstStride + dstX * dstBpp;
+
+        if (blendMode == GO2_BLEND_NONE)
+        {
+            go2_row_convert(srcLayout, srcFormat, gathered, dstLayout, dstFormat, dstRow, dstWidth, scratch);
+        }
+        else
+        {
+            go2_row_unpack(srcLayout, srcFormat, gathered, scratch, dstWidth);
+            go2_row_unpack(dstLayout, dstFormat, dstRow, background, dstWidth);
+            go2_row_blend(scratch, background, dstWidth, blendMode, alpha);
+            go2_row_pack(dstLayout, dstFormat, background, dstRow, dstWidth);
+        }
+    }
+
+    free(gathered);
+    free(scratch);
+    free(background);
+
+    return 0;
+}
+
+int go2_blitter_sw_blit(const uint8_t* src, int srcStride, uint32_t srcFormat, int srcX, int srcY, int srcWidth, int srcHeight,
+                        uint8_t* dst, int dstStride, uint32_t dstFormat, int dstX, int dstY, int dstWidth, int dstHeight,
+                        go2_rotation_t rotation)
+{
+    return go2_blit_rows(src, srcStride, srcFormat, srcX, srcY, srcWidth, srcHeight,
+                         dst, dstStride, dstFormat, dstX, dstY, dstWidth, dstHeight,
+                         rotation, GO2_BLEND_NONE, 255);
+}
+
+int go2_blitter_sw_blend(const uint8_t* src, int srcStride, uint32_t srcFormat, int srcX, int srcY, int srcWidth, int srcHeight,
+                         uint8_t* dst, int dstStride, uint32_t dstFormat, int dstX, int dstY, int dstWidth, int dstHeight,
+                         go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha)
+{
+    return go2_blit_rows(src, srcStride, srcFormat, srcX, srcY, srcWidth, srcHeight,
+                         dst, dstStride, dstFormat, dstX, dstY, dstWidth, dstHeight,
+                         rotation, blendMode, alpha);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "display.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// CPU implementation of the blit and color fill operations. Pixel layouts follow
+// the RK_FORMAT each DRM fourcc is mapped to for RGA so that both backends
+// produce the same output for the same request.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool go2_blitter_sw_format_supported(uint32_t format);
+int go2_blitter_sw_blit(const uint8_t* src, int srcStride, uint32_t srcFormat, int srcX, int srcY, int srcWidth, int srcHeight,
+                        uint8_t* dst, int dstStride, uint32_t dstFormat, int dstX, int dstY, int dstWidth, int dstHeight,
+                        go2_rotation_t rotation);
+int go2_blitter_sw_blend(const uint8_t* src, int srcStride, uint32_t srcFormat, int srcX, int srcY, int srcWidth, int srcHeight,
+                         uint8_t* dst, int dstStride, uint32_t dstFormat, int dstX, int dstY, int dstWidth, int dstHeight,
+                         go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha);
+int go2_blitter_sw_fill(uint8_t* dst, int dstStride, uint32_t dstFormat, int x, int y, int width, int height, uint32_t color);
+
+#ifdef __cplusplus
+}
+#endif
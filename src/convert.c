@@ -0,0 +1,637 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "convert.h"
+
+#include <drm/drm_fourcc.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#define GO2_CONVERT_AVX2
+#endif
+
+
+#define BLOCK_PIXELS (64)
+#define SHIFTS_MAX (10)
+
+
+typedef struct go2_channel
+{
+    uint8_t shift;
+    uint8_t bits;
+} go2_channel_t;
+
+typedef struct go2_format_info
+{
+    uint32_t format;
+    int bytes;
+    go2_channel_t channels[4];  // R, G, B, A (bits = 0 when absent)
+    go2_channel_t padding;      // X
+} go2_format_info_t;
+
+#define FORMAT(f, n, rs, rb, gs, gb, bs, bb, as, ab, xs, xb) \
+    { f, n, { { rs, rb }, { gs, gb }, { bs, bb }, { as, ab } }, { xs, xb } }
+
+static const go2_format_info_t formats[] =
+{
+    FORMAT(DRM_FORMAT_XRGB4444,     2,  8, 4,  4, 4,  0, 4,  0, 0, 12, 4),
+    FORMAT(DRM_FORMAT_XBGR4444,     2,  0, 4,  4, 4,  8, 4,  0, 0, 12, 4),
+    FORMAT(DRM_FORMAT_RGBX4444,     2, 12, 4,  8, 4,  4, 4,  0, 0,  0, 4),
+    FORMAT(DRM_FORMAT_BGRX4444,     2,  4, 4,  8, 4, 12, 4,  0, 0,  0, 4),
+    FORMAT(DRM_FORMAT_ARGB4444,     2,  8, 4,  4, 4,  0, 4, 12, 4,  0, 0),
+    FORMAT(DRM_FORMAT_ABGR4444,     2,  0, 4,  4, 4,  8, 4, 12, 4,  0, 0),
+    FORMAT(DRM_FORMAT_RGBA4444,     2, 12, 4,  8, 4,  4, 4,  0, 4,  0, 0),
+    FORMAT(DRM_FORMAT_BGRA4444,     2,  4, 4,  8, 4, 12, 4,  0, 4,  0, 0),
+
+    FORMAT(DRM_FORMAT_XRGB1555,     2, 10, 5,  5, 5,  0, 5,  0, 0, 15, 1),
+    FORMAT(DRM_FORMAT_XBGR1555,     2,  0, 5,  5, 5, 10, 5,  0, 0, 15, 1),
+    FORMAT(DRM_FORMAT_RGBX5551,     2, 11, 5,  6, 5,  1, 5,  0, 0,  0, 1),
+    FORMAT(DRM_FORMAT_BGRX5551,     2,  1, 5,  6, 5, 11, 5,  0, 0,  0, 1),
+    FORMAT(DRM_FORMAT_ARGB1555,     2, 10, 5,  5, 5,  0, 5, 15, 1,  0, 0),
+    FORMAT(DRM_FORMAT_ABGR1555,     2,  0, 5,  5, 5, 10, 5, 15, 1,  0, 0),
+    FORMAT(DRM_FORMAT_RGBA5551,     2, 11, 5,  6, 5,  1, 5,  0, 1,  0, 0),
+    FORMAT(DRM_FORMAT_BGRA5551,     2,  1, 5,  6, 5, 11, 5,  0, 1,  0, 0),
+
+    FORMAT(DRM_FORMAT_RGB565,       2, 11, 5,  5, 6,  0, 5,  0, 0,  0, 0),
+    FORMAT(DRM_FORMAT_BGR565,       2,  0, 5,  5, 6, 11, 5,  0, 0,  0, 0),
+
+    // RK byte order, as mapped for RGA: bytes R G B / B G R
+    FORMAT(DRM_FORMAT_RGB888,       3,  0, 8,  8, 8, 16, 8,  0, 0,  0, 0),
+    FORMAT(DRM_FORMAT_BGR888,       3, 16, 8,  8, 8,  0, 8,  0, 0,  0, 0),
+
+    FORMAT(DRM_FORMAT_XRGB8888,     4, 16, 8,  8, 8,  0, 8,  0, 0, 24, 8),
+    FORMAT(DRM_FORMAT_XBGR8888,     4,  0, 8,  8, 8, 16, 8,  0, 0, 24, 8),
+    FORMAT(DRM_FORMAT_RGBX8888,     4,  0, 8,  8, 8, 16, 8,  0, 0, 24, 8),    // RK: bytes R G B X
+    FORMAT(DRM_FORMAT_BGRX8888,     4,  8, 8, 16, 8, 24, 8,  0, 0,  0, 8),
+    FORMAT(DRM_FORMAT_ARGB8888,     4, 16, 8,  8, 8,  0, 8, 24, 8,  0, 0),
+    FORMAT(DRM_FORMAT_ABGR8888,     4,  0, 8,  8, 8, 16, 8, 24, 8,  0, 0),
+    FORMAT(DRM_FORMAT_RGBA8888,     4,  0, 8,  8, 8, 16, 8, 24, 8,  0, 0),    // RK: bytes R G B A
+    FORMAT(DRM_FORMAT_BGRA8888,     4,  8, 8, 16, 8, 24, 8,  0, 8,  0, 0),
+
+    FORMAT(DRM_FORMAT_XRGB2101010,  4, 20, 10, 10, 10,  0, 10,  0, 0, 30, 2),
+    FORMAT(DRM_FORMAT_XBGR2101010,  4,  0, 10, 10, 10, 20, 10,  0, 0, 30, 2),
+    FORMAT(DRM_FORMAT_RGBX1010102,  4, 22, 10, 12, 10,  2, 10,  0, 0,  0, 2),
+    FORMAT(DRM_FORMAT_BGRX1010102,  4,  2, 10, 12, 10, 22, 10,  0, 0,  0, 2),
+    FORMAT(DRM_FORMAT_ARGB2101010,  4, 20, 10, 10, 10,  0, 10, 30, 2,  0, 0),
+    FORMAT(DRM_FORMAT_ABGR2101010,  4,  0, 10, 10, 10, 20, 10, 30, 2,  0, 0),
+    FORMAT(DRM_FORMAT_RGBA1010102,  4, 22, 10, 12, 10,  2, 10,  0, 2,  0, 0),
+    FORMAT(DRM_FORMAT_BGRA1010102,  4,  2, 10, 12, 10, 22, 10,  0, 2,  0, 0),
+};
+
+#undef FORMAT
+
+
+static const go2_format_info_t* go2_format_info_get(uint32_t format)
+{
+    for (int i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+    {
+        if (formats[i].format == format)
+        {
+            return &formats[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool go2_convert_format_supported(uint32_t format)
+{
+    return go2_format_info_get(format) != NULL;
+}
+
+int go2_convert_format_bytes(uint32_t format)
+{
+    const go2_format_info_t* info = go2_format_info_get(format);
+    return info ? info->bytes : 0;
+}
+
+bool go2_convert_format_alpha(uint32_t format)
+{
+    const go2_format_info_t* info = go2_format_info_get(format);
+    return info && info->channels[3].bits > 0;
+}
+
+
+// A conversion is a list of per channel operations applied to each pixel
+// held in a 32 bit lane:
+//   c = (pixel >> srcShift) & srcMask
+//   v = c shifted by each entry of shifts (negative = right), ORed together
+//   out |= v << dstShift
+// The shift list replicates the source bits until the destination width is
+// filled, which also covers narrowing (a single right shift).
+typedef struct go2_channel_op
+{
+    int srcShift;
+    uint32_t srcMask;
+    int dstShift;
+    int shifts[SHIFTS_MAX];
+    int shiftCount;
+} go2_channel_op_t;
+
+typedef struct go2_convert_plan
+{
+    int srcBytes;
+    int dstBytes;
+    go2_channel_op_t ops[4];
+    int opCount;
+    uint32_t constant;
+} go2_convert_plan_t;
+
+
+static uint32_t go2_ones(int bits)
+{
+    return bits >= 32 ? 0xffffffff : (1u << bits) - 1;
+}
+
+static int go2_convert_plan_init(go2_convert_plan_t* plan, uint32_t srcFormat, uint32_t dstFormat)
+{
+    const go2_format_info_t* src = go2_format_info_get(srcFormat);
+    const go2_format_info_t* dst = go2_format_info_get(dstFormat);
+    if (!src || !dst)
+    {
+        printf("go2_convert: format not supported.\n");
+        return -1;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+
+    plan->srcBytes = src->bytes;
+    plan->dstBytes = dst->bytes;
+    plan->constant = go2_ones(dst->padding.bits) << dst->padding.shift;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        const go2_channel_t* s = &src->channels[i];
+        const go2_channel_t* d = &dst->channels[i];
+
+        if (d->bits == 0)
+        {
+            continue;
+        }
+
+        if (s->bits == 0)
+        {
+            // Missing alpha is opaque
+            plan->constant |= go2_ones(d->bits) << d->shift;
+            continue;
+        }
+
+        go2_channel_op_t* op = &plan->ops[plan->opCount++];
+        op->srcShift = s->shift;
+        op->srcMask = go2_ones(s->bits);
+        op->dstShift = d->shift;
+
+        for (int k = 1; ; ++k)
+        {
+            int shift = d->bits - k * s->bits;
+            op->shifts[op->shiftCount++] = shift;
+            if (shift <= 0) break;
+        }
+    }
+
+    return 0;
+}
+
+
+static void go2_load_scalar(const uint8_t* src, int bytes, uint32_t* lanes, int count)
+{
+    switch (bytes)
+    {
+        case 2:
+            for (int i = 0; i < count; ++i, src += 2)
+                lanes[i] = src[0] | ((uint32_t)src[1] << 8);
+            break;
+
+        case 3:
+            for (int i = 0; i < count; ++i, src += 3)
+                lanes[i] = src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16);
+            break;
+
+        default:
+            memcpy(lanes, src, count * 4);
+            break;
+    }
+}
+
+static void go2_store_scalar(const uint32_t* lanes, uint8_t* dst, int bytes, int count)
+{
+    switch (bytes)
+    {
+        case 2:
+            for (int i = 0; i < count; ++i, dst += 2)
+            {
+                dst[0] = lanes[i];
+                dst[1] = lanes[i] >> 8;
+            }
+            break;
+
+        case 3:
+            for (int i = 0; i < count; ++i, dst += 3)
+            {
+                dst[0] = lanes[i];
+                dst[1] = lanes[i] >> 8;
+                dst[2] = lanes[i] >> 16;
+            }
+            break;
+
+        default:
+            memcpy(dst, lanes, count * 4);
+            break;
+    }
+}
+
+static void go2_ops_scalar(const go2_convert_plan_t* plan, uint32_t* lanes, int start, int count)
+{
+    for (int i = start; i < count; ++i)
+    {
+        uint32_t p = lanes[i];
+        uint32_t out = plan->constant;
+
+        for (int j = 0; j < plan->opCount; ++j)
+        {
+            const go2_channel_op_t* op = &plan->ops[j];
+            uint32_t c = (p >> op->srcShift) & op->srcMask;
+            uint32_t v = 0;
+
+            for (int k = 0; k < op->shiftCount; ++k)
+            {
+                int shift = op->shifts[k];
+                v |= shift >= 0 ? c << shift : c >> -shift;
+            }
+
+            out |= v << op->dstShift;
+        }
+
+        lanes[i] = out;
+    }
+}
+
+
+#if defined(__ARM_NEON)
+
+static void go2_load(const uint8_t* src, int bytes, uint32_t* lanes, int count)
+{
+    int i = 0;
+
+    if (bytes == 2)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t p = vld1q_u16((const uint16_t*)(src + i * 2));
+            vst1q_u32(lanes + i, vmovl_u16(vget_low_u16(p)));
+            vst1q_u32(lanes + i + 4, vmovl_u16(vget_high_u16(p)));
+        }
+    }
+    else if (bytes == 3)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8x8x3_t p = vld3_u8(src + i * 3);
+            uint16x8_t b0 = vmovl_u8(p.val[0]);
+            uint16x8_t b1 = vmovl_u8(p.val[1]);
+            uint16x8_t b2 = vmovl_u8(p.val[2]);
+            uint16x8_t lo = vorrq_u16(b0, vshlq_n_u16(b1, 8));
+
+            vst1q_u32(lanes + i, vorrq_u32(vmovl_u16(vget_low_u16(lo)), vshlq_n_u32(vmovl_u16(vget_low_u16(b2)), 16)));
+            vst1q_u32(lanes + i + 4, vorrq_u32(vmovl_u16(vget_high_u16(lo)), vshlq_n_u32(vmovl_u16(vget_high_u16(b2)), 16)));
+        }
+    }
+
+    go2_load_scalar(src + i * bytes, bytes, lanes + i, count - i);
+}
+
+static void go2_store(const uint32_t* lanes, uint8_t* dst, int bytes, int count)
+{
+    int i = 0;
+
+    if (bytes == 2)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t p = vcombine_u16(vmovn_u32(vld1q_u32(lanes + i)), vmovn_u32(vld1q_u32(lanes + i + 4)));
+            vst1q_u16((uint16_t*)(dst + i * 2), p);
+        }
+    }
+    else if (bytes == 3)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            uint32x4_t lo = vld1q_u32(lanes + i);
+            uint32x4_t hi = vld1q_u32(lanes + i + 4);
+            uint8x8x3_t p;
+            p.val[0] = vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+            p.val[1] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(lo, 8)), vmovn_u32(vshrq_n_u32(hi, 8))));
+            p.val[2] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(lo, 16)), vmovn_u32(vshrq_n_u32(hi, 16))));
+            vst3_u8(dst + i * 3, p);
+        }
+    }
+
+    go2_store_scalar(lanes + i, dst + i * bytes, bytes, count - i);
+}
+
+static void go2_ops(const go2_convert_plan_t* plan, uint32_t* lanes, int count)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t p = vld1q_u32(lanes + i);
+        uint32x4_t out = vdupq_n_u32(plan->constant);
+
+        for (int j = 0; j < plan->opCount; ++j)
+        {
+            const go2_channel_op_t* op = &plan->ops[j];
+            uint32x4_t c = vandq_u32(vshlq_u32(p, vdupq_n_s32(-op->srcShift)), vdupq_n_u32(op->srcMask));
+            uint32x4_t v = vdupq_n_u32(0);
+
+            for (int k = 0; k < op->shiftCount; ++k)
+            {
+                // vshlq shifts right for negative counts
+                v = vorrq_u32(v, vshlq_u32(c, vdupq_n_s32(op->shifts[k])));
+            }
+
+            out = vorrq_u32(out, vshlq_u32(v, vdupq_n_s32(op->dstShift)));
+        }
+
+        vst1q_u32(lanes + i, out);
+    }
+
+    go2_ops_scalar(plan, lanes, i, count);
+}
+
+#elif defined(__SSE2__)
+
+static void go2_load(const uint8_t* src, int bytes, uint32_t* lanes, int count)
+{
+    int i = 0;
+
+    if (bytes == 2)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 2));
+            _mm_storeu_si128((__m128i*)(lanes + i), _mm_unpacklo_epi16(p, zero));
+            _mm_storeu_si128((__m128i*)(lanes + i + 4), _mm_unpackhi_epi16(p, zero));
+        }
+    }
+
+    go2_load_scalar(src + i * bytes, bytes, lanes + i, count - i);
+}
+
+static void go2_store(const uint32_t* lanes, uint8_t* dst, int bytes, int count)
+{
+    int i = 0;
+
+    if (bytes == 2)
+    {
+        // packs saturates signed values, so bias the 16 bit range first
+        const __m128i bias32 = _mm_set1_epi32(0x8000);
+        const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i lo = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(lanes + i)), bias32);
+            __m128i hi = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(lanes + i + 4)), bias32);
+            _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_add_epi16(_mm_packs_epi32(lo, hi), bias16));
+        }
+    }
+
+    go2_store_scalar(lanes + i, dst + i * bytes, bytes, count - i);
+}
+
+static void go2_ops_sse2(const go2_convert_plan_t* plan, uint32_t* lanes, int count)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(lanes + i));
+        __m128i out = _mm_set1_epi32(plan->constant);
+
+        for (int j = 0; j < plan->opCount; ++j)
+        {
+            const go2_channel_op_t* op = &plan->ops[j];
+            __m128i c = _mm_and_si128(_mm_srl_epi32(p, _mm_cvtsi32_si128(op->srcShift)), _mm_set1_epi32(op->srcMask));
+            __m128i v = _mm_setzero_si128();
+
+            for (int k = 0; k < op->shiftCount; ++k)
+            {
+                int shift = op->shifts[k];
+                v = _mm_or_si128(v, shift >= 0 ? _mm_sll_epi32(c, _mm_cvtsi32_si128(shift)) :
+                                                 _mm_srl_epi32(c, _mm_cvtsi32_si128(-shift)));
+            }
+
+            out = _mm_or_si128(out, _mm_sll_epi32(v, _mm_cvtsi32_si128(op->dstShift)));
+        }
+
+        _mm_storeu_si128((__m128i*)(lanes + i), out);
+    }
+
+    go2_ops_scalar(plan, lanes, i, count);
+}
+
+__attribute__((target("avx2")))
+static void go2_ops_avx2(const go2_convert_plan_t* plan, uint32_t* lanes, int count)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(lanes + i));
+        __m256i out = _mm256_set1_epi32(plan->constant);
+
+        for (int j = 0; j < plan->opCount; ++j)
+        {
+            const go2_channel_op_t* op = &plan->ops[j];
+            __m256i c = _mm256_and_si256(_mm256_srl_epi32(p, _mm_cvtsi32_si128(op->srcShift)), _mm256_set1_epi32(op->srcMask));
+            __m256i v = _mm256_setzero_si256();
+
+            for (int k = 0; k < op->shiftCount; ++k)
+            {
+                int shift = op->shifts[k];
+                v = _mm256_or_si256(v, shift >= 0 ? _mm256_sll_epi32(c, _mm_cvtsi32_si128(shift)) :
+                                                    _mm256_srl_epi32(c, _mm_cvtsi32_si128(-shift)));
+            }
+
+            out = _mm256_or_si256(out, _mm256_sll_epi32(v, _mm_cvtsi32_si128(op->dstShift)));
+        }
+
+        _mm256_storeu_si256((__m256i*)(lanes + i), out);
+    }
+
+    go2_ops_sse2(plan, lanes + i, count - i);
+}
+
+static void go2_ops(const go2_convert_plan_t* plan, uint32_t* lanes, int count)
+{
+    static int avx2 = -1;
+    if (avx2 < 0)
+    {
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    if (avx2)
+    {
+        go2_ops_avx2(plan, lanes, count);
+    }
+    else
+    {
+        go2_ops_sse2(plan, lanes, count);
+    }
+}
+
+#else
+
+static void go2_load(const uint8_t* src, int bytes, uint32_t* lanes, int count)
+{
+    go2_load_scalar(src, bytes, lanes, count);
+}
+
+static void go2_store(const uint32_t* lanes, uint8_t* dst, int bytes, int count)
+{
+    go2_store_scalar(lanes, dst, bytes, count);
+}
+
+static void go2_ops(const go2_convert_plan_t* plan, uint32_t* lanes, int count)
+{
+    go2_ops_scalar(plan, lanes, 0, count);
+}
+
+#endif
+
+
+int go2_convert(const void* src, int srcStride, uint32_t srcFormat,
+                void* dst, int dstStride, uint32_t dstFormat,
+                int width, int height)
+{
+    go2_convert_plan_t plan;
+    if (go2_convert_plan_init(&plan, srcFormat, dstFormat))
+    {
+        return -1;
+    }
+
+    const uint8_t* srcRow = (const uint8_t*)src;
+    uint8_t* dstRow = (uint8_t*)dst;
+
+    if (srcFormat == dstFormat)
+    {
+        for (int y = 0; y < height; ++y, srcRow += srcStride, dstRow += dstStride)
+        {
+            memcpy(dstRow, srcRow, (size_t)width * plan.srcBytes);
+        }
+
+        return 0;
+    }
+
+    _Alignas(32) uint32_t lanes[BLOCK_PIXELS];
+
+    for (int y = 0; y < height; ++y, srcRow += srcStride, dstRow += dstStride)
+    {
+        for (int x = 0; x < width; x += BLOCK_PIXELS)
+        {
+            int count = (width - x < BLOCK_PIXELS) ? width - x : BLOCK_PIXELS;
+
+            go2_load(srcRow + x * plan.srcBytes, plan.srcBytes, lanes, count);
+            go2_ops(&plan, lanes, count);
+            go2_store(lanes, dstRow + x * plan.dstBytes, plan.dstBytes, count);
+        }
+    }
+
+    return 0;
+}
+
+
+static uint32_t go2_channel_convert(uint32_t value, int from, int to)
+{
+    if (to <= from)
+    {
+        return value >> (from - to);
+    }
+
+    // Repeat the source bits until the destination width is covered
+    uint64_t result = 0;
+    int bits = 0;
+    while (bits < to)
+    {
+        result = (result << from) | value;
+        bits += from;
+    }
+
+    return (uint32_t)(result >> (bits - to));
+}
+
+int go2_convert_reference(const void* src, int srcStride, uint32_t srcFormat,
+                          void* dst, int dstStride, uint32_t dstFormat,
+                          int width, int height)
+{
+    const go2_format_info_t* s = go2_format_info_get(srcFormat);
+    const go2_format_info_t* d = go2_format_info_get(dstFormat);
+    if (!s || !d)
+    {
+        printf("go2_convert_reference: format not supported.\n");
+        return -1;
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        if (srcFormat == dstFormat)
+        {
+            memcpy((uint8_t*)dst + (size_t)y * dstStride, (const uint8_t*)src + (size_t)y * srcStride, (size_t)width * s->bytes);
+            continue;
+        }
+
+        const uint8_t* srcPixel = (const uint8_t*)src + (size_t)y * srcStride;
+        uint8_t* dstPixel = (uint8_t*)dst + (size_t)y * dstStride;
+
+        for (int x = 0; x < width; ++x, srcPixel += s->bytes, dstPixel += d->bytes)
+        {
+            uint32_t p = 0;
+            for (int i = 0; i < s->bytes; ++i)
+            {
+                p |= (uint32_t)srcPixel[i] << (i * 8);
+            }
+
+            uint32_t out = go2_ones(d->padding.bits) << d->padding.shift;
+            for (int c = 0; c < 4; ++c)
+            {
+                const go2_channel_t* sc = &s->channels[c];
+                const go2_channel_t* dc = &d->channels[c];
+
+                if (dc->bits == 0) continue;
+
+                uint32_t value = sc->bits ? go2_channel_convert((p >> sc->shift) & go2_ones(sc->bits), sc->bits, dc->bits)
+                                          : go2_ones(dc->bits);
+                out |= value << dc->shift;
+            }
+
+            for (int i = 0; i < d->bytes; ++i)
+            {
+                dstPixel[i] = out >> (i * 8);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// CPU pixel format conversion between every 16, 24 and 32 bit RGB format
+// known to go2_drm_format_get_bpp. Channel layouts follow drm_fourcc.h
+// (little endian packed words), except RGBA8888, RGBX8888, RGB888 and
+// BGR888, which use the RK_FORMAT byte order they are mapped to for RGA so
+// the result matches the blitters. Channels are narrowed by truncation and
+// widened by bit replication; X channels are written as all ones. Identical
+// formats are copied unchanged.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool go2_convert_format_supported(uint32_t format);
+int go2_convert_format_bytes(uint32_t format);
+bool go2_convert_format_alpha(uint32_t format);
+int go2_convert(const void* src, int srcStride, uint32_t srcFormat,
+                void* dst, int dstStride, uint32_t dstFormat,
+                int width, int height);
+
+// Scalar implementation defining the exact output of go2_convert
+int go2_convert_reference(const void* src, int srcStride, uint32_t srcFormat,
+                          void* dst, int dstStride, uint32_t dstFormat,
+                          int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,6 +20,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "display.h"
 
 #include "queue.h"
+#include "blitter.h"
+#include "screenshot.h"
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -38,6 +40,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdbool.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <poll.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
 
 #include <rga/RgaApi.h>
 
@@ -48,7 +57,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 // #include <GLES2/gl2.h>
 // #include <GLES2/gl2ext.h>
 
-#include <png.h>
 
 
 typedef struct go2_display
@@ -59,8 +67,37 @@ typedef struct go2_display
     uint32_t width;
     uint32_t height;
     uint32_t crtc_id;
+    bool crtc_configured;
+    volatile bool flip_pending;
+    uint32_t vblank_sequence;
+    uint64_t vblank_timestamp;
+    pthread_mutex_t gem_mutex;
+    struct go2_gem_reference* gem_references;
+    int gem_reference_count;
+    drmModeModeInfo* modes;
+    int mode_count;
+    int mode_index;
+    _Atomic int mode_pending;
 } go2_display_t;
 
+// drmPrimeFDToHandle returns the existing GEM handle when a buffer is
+// imported again, or when it came from a dumb buffer or GBM bo on the same
+// fd, so every handle the library holds is reference counted per display.
+// The first owner decides how the handle is finally released.
+typedef enum go2_gem_owner
+{
+    GO2_GEM_OWNER_DUMB = 0,     // DRM_IOCTL_MODE_DESTROY_DUMB
+    GO2_GEM_OWNER_IMPORT,       // DRM_IOCTL_GEM_CLOSE
+    GO2_GEM_OWNER_GBM           // closed by GBM with its bo
+} go2_gem_owner_t;
+
+typedef struct go2_gem_reference
+{
+    uint32_t handle;
+    int count;
+    go2_gem_owner_t owner;
+} go2_gem_reference_t;
+
 typedef struct go2_surface
 {
     go2_display_t* display;
@@ -73,14 +110,89 @@ typedef struct go2_surface
     int prime_fd;
     bool is_mapped;
     uint8_t* map;
+    uint32_t serial;
+    struct go2_frame_buffer* frame_buffer;
+    bool is_imported;
+    uint32_t offset;
+    struct go2_context_buffer* context_buffer;
+    uint8_t* shadow;
+    bool shadow_valid;
+    int dirty_top;
+    int dirty_bottom;
+    bool dirty_marked;          // rows were added during the current access
+    pthread_mutex_t shadow_mutex;   // shadow and dirty rows; blit workers flush them
+    go2_surface_access_t access;
 } go2_surface_t;
 
+// Points in a frame's life recorded by the presenter
+enum
+{
+    Timestamp_PostEntry = 0,
+    Timestamp_Acquired,
+    Timestamp_Filled,
+    Timestamp_Blitted,
+    Timestamp_Queued,
+    Timestamp_FlipSubmitted,
+    Timestamp_FlipCompleted,
+
+    PRESENTER_TIMESTAMP_COUNT
+};
+
+typedef struct go2_rect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+} go2_rect_t;
+
 typedef struct go2_frame_buffer
 {
     go2_surface_t* surface;
     uint32_t fb_id;
+
+    // Set on frame buffers the presenter scans out without owning them.
+    // Called once the buffer has left the screen.
+    void (*release)(struct go2_frame_buffer* frame_buffer);
+    void* release_data;
+    uint64_t timestamps[PRESENTER_TIMESTAMP_COUNT];
+
+    // Presenter frames shown on the overlay plane instead of flipped
+    bool overlay;
+    go2_rect_t overlay_src;
+    go2_rect_t overlay_dst;
 } go2_frame_buffer_t;
 
+// A GL front buffer wrapped as a surface, stored as gbm_bo user data.
+// The buffer goes back to GBM once both the application and the presenter
+// have released it.
+typedef struct go2_context_buffer
+{
+    struct gbm_surface* gbmSurface;
+    struct gbm_bo* gbmBuffer;
+    go2_surface_t* surface;
+    _Atomic int holds;
+} go2_context_buffer_t;
+
+#define STATS_WINDOW (256)
+
+typedef struct go2_presenter_buffer
+{
+    bool valid;
+    go2_rect_t rect;
+    uint32_t color;
+    struct go2_blit_plan* plan;
+    uint64_t timestamps[PRESENTER_TIMESTAMP_COUNT];
+} go2_presenter_buffer_t;
+
+typedef struct go2_presenter_histogram
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t samples[STATS_WINDOW];
+} go2_presenter_histogram_t;
+
 typedef struct go2_presenter
 {
     go2_display_t* display;
@@ -93,9 +205,44 @@ typedef struct go2_presenter
     sem_t freeSem;
     sem_t usedSem;
     volatile bool terminating;
+    volatile go2_present_mode_t presentMode;
+    uint64_t droppedFrames;
+    go2_background_mode_t backgroundMode;
+    go2_frame_buffer_t** frameBuffers;
+    go2_presenter_buffer_t* bufferStates;
+    int bufferCount;
+    pthread_mutex_t statsMutex;
+    uint64_t framesPosted;
+    uint64_t framesPresented;
+    go2_presenter_histogram_t histograms[GO2_PRESENTER_STAGE_MAX];
+    uint32_t overlayPlane;
+    uint32_t* overlayFormats;
+    int overlayFormatCount;
+    go2_frame_buffer_t* overlayFrames;
+    go2_queue_t* freeOverlayFrames;
+    sem_t overlaySem;
+    bool overlayPosting;    // post side: the last post went to the overlay
+    bool overlayActive;     // render thread: the plane is showing a frame
+    bool overlayFailed;
+    go2_rect_t overlayFailedSrc;
+    go2_rect_t overlayFailedDst;
+    uint32_t overlayFailedSerial;
+    pthread_mutex_t captureMutex;
+    struct go2_capture* capture;
+    go2_viewport_t viewport;
+    bool viewportValid;
+    int viewportSrcWidth;
+    int viewportSrcHeight;
+    go2_rotation_t viewportRotation;
+    go2_rect_t viewportSrc;
+    go2_rect_t viewportDst;
 } go2_presenter_t;
 
 
+static const char* DRM_DEVICE_NAME = "/dev/dri/card0";
+static const char* DRM_DEVICE_ENV_NAME = "GO2_DRM_DEVICE";
+#define FLIP_TIMEOUT_MS (1000)
+
 go2_display_t* go2_display_create()
 {
     int i;
@@ -110,12 +257,20 @@ go2_display_t* go2_display_create()
 
     memset(result, 0, sizeof(*result));
 
+    pthread_mutex_init(&result->gem_mutex, NULL);
+
 
     // Open device
-    result->fd = open("/dev/dri/card0", O_RDWR);
+    const char* device_name = getenv(DRM_DEVICE_ENV_NAME);
+    if (!device_name)
+    {
+        device_name = DRM_DEVICE_NAME;
+    }
+
+    result->fd = open(device_name, O_RDWR | O_CLOEXEC);
     if (result->fd < 0)
     {
-        printf("open /dev/dri/card0 failed.\n");
+        printf("open %s failed.\n", device_name);
         goto err_00;
     }
 
@@ -170,6 +325,19 @@ go2_display_t* go2_display_create()
         goto err_03;
     }
 
+    // Keep every mode for go2_display_mode_set
+    result->modes = malloc(connector->count_modes * sizeof(*result->modes));
+    if (!result->modes)
+    {
+        printf("malloc failed.\n");
+        goto err_03;
+    }
+
+    memcpy(result->modes, connector->modes, connector->count_modes * sizeof(*result->modes));
+    result->mode_count = connector->count_modes;
+    result->mode_index = i;
+    result->mode_pending = -1;
+
     result->mode = *mode;
     result->width = mode->hdisplay;
     result->height = mode->vdisplay;
@@ -193,6 +361,7 @@ go2_display_t* go2_display_create()
     {
 
         printf("could not find encoder!\n");
+        free(result->modes);
         goto err_03;
     }
     
@@ -224,6 +393,20 @@ out:
 
 void go2_display_destroy(go2_display_t* display)
 {
+    // Surfaces, pools or contexts still holding GEM handles
+    static const char* ownerNames[] = { "dumb", "import", "gbm" };
+    for (int i = 0; i < display->gem_reference_count; ++i)
+    {
+        go2_gem_reference_t* reference = &display->gem_references[i];
+
+        printf("go2_display_destroy: GEM handle %u leaked (%s, %d owners).\n",
+               reference->handle, ownerNames[reference->owner], reference->count);
+    }
+
+    pthread_mutex_destroy(&display->gem_mutex);
+    free(display->gem_references);
+    free(display->modes);
+
     close(display->fd);
     free(display);
 }
@@ -238,13 +421,335 @@ int go2_display_height_get(go2_display_t* display)
     return display->height;
 }
 
-void go2_display_present(go2_display_t* display, go2_frame_buffer_t* frame_buffer)
+static uint32_t go2_display_mode_refresh_get(const drmModeModeInfo* mode)
+{
+    uint64_t numerator = (uint64_t)mode->clock * 1000000;
+    uint64_t denominator = (uint64_t)mode->htotal * mode->vtotal;
+
+    if (mode->flags & DRM_MODE_FLAG_INTERLACE) numerator *= 2;
+    if (mode->flags & DRM_MODE_FLAG_DBLSCAN) denominator *= 2;
+    if (mode->vscan > 1) denominator *= mode->vscan;
+
+    if (denominator == 0)
+    {
+        return 0;
+    }
+
+    return (uint32_t)((numerator + denominator / 2) / denominator);
+}
+
+int go2_display_mode_count_get(go2_display_t* display)
+{
+    return display->mode_count;
+}
+
+int go2_display_mode_get(go2_display_t* display, int index, go2_display_mode_t* mode)
+{
+    if (index < 0 || index >= display->mode_count)
+    {
+        return -1;
+    }
+
+    const drmModeModeInfo* info = &display->modes[index];
+
+    memset(mode, 0, sizeof(*mode));
+    mode->width = info->hdisplay;
+    mode->height = info->vdisplay;
+    mode->refresh_mhz = go2_display_mode_refresh_get(info);
+    mode->clock_khz = info->clock;
+    mode->htotal = info->htotal;
+    mode->vtotal = info->vtotal;
+    mode->preferred = (info->type & DRM_MODE_TYPE_PREFERRED) != 0;
+
+    return 0;
+}
+
+int go2_display_mode_current_get(go2_display_t* display)
+{
+    int pending = atomic_load(&display->mode_pending);
+    return pending >= 0 ? pending : display->mode_index;
+}
+
+int go2_display_mode_set(go2_display_t* display, int index)
+{
+    if (index < 0 || index >= display->mode_count)
+    {
+        printf("go2_display_mode_set: invalid mode.\n");
+        return -1;
+    }
+
+    // Surfaces and presenters are sized to the display, so only the timing
+    // may change.
+    const drmModeModeInfo* info = &display->modes[index];
+    if (info->hdisplay != display->width || info->vdisplay != display->height)
+    {
+        printf("go2_display_mode_set: resolution change not supported.\n");
+        return -1;
+    }
+
+    // Applied by the next presented frame
+    atomic_store(&display->mode_pending, index);
+
+    return 0;
+}
+
+int go2_display_mode_find(go2_display_t* display, uint32_t refresh_mhz)
+{
+    int result = -1;
+    uint64_t bestError = UINT64_MAX;
+
+    if (refresh_mhz == 0)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < display->mode_count; ++i)
+    {
+        const drmModeModeInfo* info = &display->modes[i];
+        if (info->hdisplay != display->width || info->vdisplay != display->height)
+        {
+            continue;
+        }
+
+        uint32_t rate = go2_display_mode_refresh_get(info);
+
+        // Content shown for a whole number of refreshes per frame paces
+        // evenly, so multiples of the requested rate are accepted too.
+        for (uint32_t k = 1; k <= 4; ++k)
+        {
+            uint64_t target = (uint64_t)refresh_mhz * k;
+            uint64_t error = (rate > target ? rate - target : target - rate) / k;
+
+            if (error < bestError)
+            {
+                bestError = error;
+                result = i;
+            }
+        }
+    }
+
+    return result;
+}
+
+static void go2_display_page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void* user_data)
+{
+    go2_display_t* display = (go2_display_t*)user_data;
+
+    display->vblank_sequence = sequence;
+    display->vblank_timestamp = (uint64_t)tv_sec * 1000000000ull + (uint64_t)tv_usec * 1000ull;
+    display->flip_pending = false;
+}
+
+static int go2_display_modeset(go2_display_t* display, uint32_t fb_id)
+{
+    int ret = drmModeSetCrtc(display->fd, display->crtc_id, fb_id, 0, 0, &display->connector_id, 1, &display->mode);
+    if (ret)
+    {
+        printf("drmModeSetCrtc failed.\n");
+        display->crtc_configured = false;
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    display->vblank_sequence++;
+    display->vblank_timestamp = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    display->crtc_configured = true;
+
+    return 0;
+}
+
+static int go2_display_flip_submit(go2_display_t* display, uint32_t fb_id)
 {
-    int ret = drmModeSetCrtc(display->fd, display->crtc_id, frame_buffer->fb_id, 0, 0, &display->connector_id, 1, &display->mode);
+    int pending = atomic_exchange(&display->mode_pending, -1);
+    if (pending >= 0)
+    {
+        display->mode = display->modes[pending];
+        display->mode_index = pending;
+        display->crtc_configured = false;
+    }
+
+    // The first frame (or one after a mode change) requires a full modeset.
+    // Everything after that is a page flip completed at vblank.
+    if (!display->crtc_configured)
+    {
+        return go2_display_modeset(display, fb_id);
+    }
+
+    display->flip_pending = true;
+
+    int ret = drmModePageFlip(display->fd, display->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, display);
     if (ret)
     {
-        printf("drmModeSetCrtc failed.\n");        
+        printf("drmModePageFlip failed.\n");
+        display->flip_pending = false;
+
+        return go2_display_modeset(display, fb_id);
+    }
+
+    return 0;
+}
+
+static void go2_display_flip_wait(go2_display_t* display)
+{
+    drmEventContext context = { 0 };
+    context.version = 2;
+    context.page_flip_handler = go2_display_page_flip_handler;
+
+    while (display->flip_pending)
+    {
+        struct pollfd pfd = { 0 };
+        pfd.fd = display->fd;
+        pfd.events = POLLIN;
+
+        int ret = poll(&pfd, 1, FLIP_TIMEOUT_MS);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+
+            printf("poll failed.\n");
+            display->flip_pending = false;
+            break;
+        }
+        else if (ret == 0)
+        {
+            printf("page flip timed out.\n");
+            display->flip_pending = false;
+            break;
+        }
+
+        if (drmHandleEvent(display->fd, &context))
+        {
+            printf("drmHandleEvent failed.\n");
+        }
+    }
+}
+
+void go2_display_present(go2_display_t* display, go2_frame_buffer_t* frame_buffer)
+{
+    if (go2_display_flip_submit(display, frame_buffer->fb_id) == 0)
+    {
+        go2_display_flip_wait(display);
+    }
+}
+
+void go2_display_vblank_get(go2_display_t* display, uint32_t* sequence, uint64_t* timestamp_ns)
+{
+    if (sequence) *sequence = display->vblank_sequence;
+    if (timestamp_ns) *timestamp_ns = display->vblank_timestamp;
+}
+
+// Waits for a vblank and records it like a completed flip. An absolute
+// sequence that has already passed returns at once; a relative wait of 0
+// just reads the counter.
+static void go2_display_vblank_wait(go2_display_t* display, drmVBlankSeqType type, uint32_t sequence)
+{
+    drmVBlank vblank = { 0 };
+    vblank.request.type = type;
+    vblank.request.sequence = sequence;
+
+    if (drmWaitVBlank(display->fd, &vblank))
+    {
+        printf("drmWaitVBlank failed.\n");
+        return;
+    }
+
+    display->vblank_sequence = vblank.reply.sequence;
+    display->vblank_timestamp = (uint64_t)vblank.reply.tval_sec * 1000000000ull + (uint64_t)vblank.reply.tval_usec * 1000ull;
+}
+
+static uint64_t go2_display_plane_type_get(go2_display_t* display, uint32_t plane_id)
+{
+    uint64_t result = DRM_PLANE_TYPE_OVERLAY;
+
+    drmModeObjectProperties* properties = drmModeObjectGetProperties(display->fd, plane_id, DRM_MODE_OBJECT_PLANE);
+    if (!properties) return result;
+
+    for (uint32_t i = 0; i < properties->count_props; ++i)
+    {
+        drmModePropertyRes* property = drmModeGetProperty(display->fd, properties->props[i]);
+        if (!property) continue;
+
+        if (strcmp(property->name, "type") == 0)
+        {
+            result = properties->prop_values[i];
+        }
+
+        drmModeFreeProperty(property);
+    }
+
+    drmModeFreeObjectProperties(properties);
+    return result;
+}
+
+// Finds an overlay plane usable on the display's CRTC. On success the
+// plane's supported formats are returned and must be freed by the caller.
+static uint32_t go2_display_overlay_plane_find(go2_display_t* display, uint32_t** formats, int* formatCount)
+{
+    uint32_t result = 0;
+
+    if (drmSetClientCap(display->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1))
+    {
+        printf("DRM_CLIENT_CAP_UNIVERSAL_PLANES not supported.\n");
+    }
+
+    drmModeRes* resources = drmModeGetResources(display->fd);
+    if (!resources)
+    {
+        printf("drmModeGetResources failed.\n");
+        return 0;
+    }
+
+    int crtcIndex = -1;
+    for (int i = 0; i < resources->count_crtcs; ++i)
+    {
+        if (resources->crtcs[i] == display->crtc_id)
+        {
+            crtcIndex = i;
+            break;
+        }
+    }
+
+    drmModeFreeResources(resources);
+
+    if (crtcIndex < 0)
+    {
+        printf("crtc not found.\n");
+        return 0;
+    }
+
+
+    drmModePlaneRes* planes = drmModeGetPlaneResources(display->fd);
+    if (!planes)
+    {
+        printf("drmModeGetPlaneResources failed.\n");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < planes->count_planes && !result; ++i)
+    {
+        drmModePlane* plane = drmModeGetPlane(display->fd, planes->planes[i]);
+        if (!plane) continue;
+
+        if ((plane->possible_crtcs & (1 << crtcIndex)) &&
+            go2_display_plane_type_get(display, plane->plane_id) == DRM_PLANE_TYPE_OVERLAY)
+        {
+            *formats = malloc(plane->count_formats * sizeof(uint32_t));
+            if (*formats)
+            {
+                memcpy(*formats, plane->formats, plane->count_formats * sizeof(uint32_t));
+                *formatCount = plane->count_formats;
+                result = plane->plane_id;
+            }
+        }
+
+        drmModeFreePlane(plane);
     }
+
+    drmModeFreePlaneResources(planes);
+
+    return result;
 }
 
 const char* BACKLIGHT_BRIGHTNESS_NAME = "/sys/class/backlight/backlight/brightness";
@@ -410,6 +915,103 @@ int go2_drm_format_get_bpp(uint32_t format)
     return result;
 }
 
+// Identifies a surface independently of its address, which malloc may reuse.
+static _Atomic uint32_t surface_serial;
+
+static uint32_t go2_surface_serial_next()
+{
+    return atomic_fetch_add(&surface_serial, 1) + 1;
+}
+
+static int go2_display_gem_reference_add(go2_display_t* display, uint32_t handle, go2_gem_owner_t owner)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&display->gem_mutex);
+
+    for (int i = 0; i < display->gem_reference_count; ++i)
+    {
+        if (display->gem_references[i].handle == handle)
+        {
+            display->gem_references[i].count++;
+            result = 0;
+            goto out;
+        }
+    }
+
+    go2_gem_reference_t* references = realloc(display->gem_references, (display->gem_reference_count + 1) * sizeof(*references));
+    if (!references)
+    {
+        printf("realloc failed.\n");
+        goto out;
+    }
+
+    references[display->gem_reference_count].handle = handle;
+    references[display->gem_reference_count].count = 1;
+    references[display->gem_reference_count].owner = owner;
+
+    display->gem_references = references;
+    display->gem_reference_count++;
+    result = 0;
+
+out:
+    pthread_mutex_unlock(&display->gem_mutex);
+    return result;
+}
+
+static void go2_display_gem_reference_release(go2_display_t* display, uint32_t handle)
+{
+    bool release = false;
+    go2_gem_owner_t owner = GO2_GEM_OWNER_GBM;
+
+    pthread_mutex_lock(&display->gem_mutex);
+
+    for (int i = 0; i < display->gem_reference_count; ++i)
+    {
+        if (display->gem_references[i].handle == handle)
+        {
+            if (--display->gem_references[i].count == 0)
+            {
+                owner = display->gem_references[i].owner;
+                display->gem_references[i] = display->gem_references[display->gem_reference_count - 1];
+                display->gem_reference_count--;
+                release = true;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&display->gem_mutex);
+
+    if (!release)
+    {
+        return;
+    }
+
+    if (owner == GO2_GEM_OWNER_DUMB)
+    {
+        struct drm_mode_destroy_dumb args = { 0 };
+        args.handle = handle;
+
+        int io = drmIoctl(display->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &args);
+        if (io < 0)
+        {
+            printf("DRM_IOCTL_MODE_DESTROY_DUMB failed.\n");
+        }
+    }
+    else if (owner == GO2_GEM_OWNER_IMPORT)
+    {
+        struct drm_gem_close args = { 0 };
+        args.handle = handle;
+
+        int io = drmIoctl(display->fd, DRM_IOCTL_GEM_CLOSE, &args);
+        if (io < 0)
+        {
+            printf("DRM_IOCTL_GEM_CLOSE failed.\n");
+        }
+    }
+}
+
 go2_surface_t* go2_surface_create(go2_display_t* display, int width, int height, uint32_t format)
 {
     go2_surface_t* result = malloc(sizeof(*result));
@@ -436,6 +1038,14 @@ go2_surface_t* go2_surface_create(go2_display_t* display, int width, int height,
     }
 
 
+    if (go2_display_gem_reference_add(display, args.handle, GO2_GEM_OWNER_DUMB))
+    {
+        struct drm_mode_destroy_dumb destroyArgs = { 0 };
+        destroyArgs.handle = args.handle;
+        drmIoctl(display->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyArgs);
+        goto out;
+    }
+
     result->display = display;
     result->gem_handle = args.handle;
     result->size = args.size;
@@ -443,6 +1053,8 @@ go2_surface_t* go2_surface_create(go2_display_t* display, int width, int height,
     result->height = height;
     result->stride = args.pitch;
     result->format = format;
+    result->serial = go2_surface_serial_next();
+    pthread_mutex_init(&result->shadow_mutex, NULL);
 
     return result;
 
@@ -451,17 +1063,91 @@ out:
     return NULL;
 }
 
-void go2_surface_destroy(go2_surface_t* surface)
+go2_surface_t* go2_surface_import_dmabuf(go2_display_t* display, int fd, int width, int height, int stride, uint32_t offset, uint32_t format)
 {
-    struct drm_mode_destroy_dumb args = { 0 };
-    args.handle = surface->gem_handle;
-
-    int io = drmIoctl(surface->display->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &args);
-    if (io < 0)
+    if (go2_drm_format_get_bpp(format) == 0 || width <= 0 || height <= 0 ||
+        stride < width * (go2_drm_format_get_bpp(format) / 8))
     {
-        printf("DRM_IOCTL_MODE_DESTROY_DUMB failed.\n");        
+        printf("go2_surface_import_dmabuf: invalid parameters.\n");
+        return NULL;
+    }
+
+    go2_surface_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    // The caller keeps ownership of fd
+    result->prime_fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    if (result->prime_fd < 0)
+    {
+        printf("dup failed.\n");
+        goto err_00;
+    }
+
+    uint32_t handle;
+    int io = drmPrimeFDToHandle(display->fd, result->prime_fd, &handle);
+    if (io < 0)
+    {
+        printf("drmPrimeFDToHandle failed.\n");
+        goto err_01;
+    }
+
+    if (go2_display_gem_reference_add(display, handle, GO2_GEM_OWNER_IMPORT))
+    {
+        // Adding only fails for a handle nothing else holds yet
+        struct drm_gem_close args = { 0 };
+        args.handle = handle;
+        drmIoctl(display->fd, DRM_IOCTL_GEM_CLOSE, &args);
+        goto err_01;
+    }
+
+    result->display = display;
+    result->gem_handle = handle;
+    result->size = (uint64_t)stride * height;
+    result->width = width;
+    result->height = height;
+    result->stride = stride;
+    result->format = format;
+    result->offset = offset;
+    result->is_imported = true;
+    result->serial = go2_surface_serial_next();
+    pthread_mutex_init(&result->shadow_mutex, NULL);
+
+    return result;
+
+
+err_01:
+    close(result->prime_fd);
+
+err_00:
+    free(result);
+    return NULL;
+}
+
+void go2_surface_destroy(go2_surface_t* surface)
+{
+    if (surface->frame_buffer)
+    {
+        go2_frame_buffer_destroy(surface->frame_buffer);
+    }
+
+    go2_surface_unmap(surface);
+    free(surface->shadow);
+    pthread_mutex_destroy(&surface->shadow_mutex);
+
+    if (surface->prime_fd > 0)
+    {
+        close(surface->prime_fd);
     }
 
+    go2_display_gem_reference_release(surface->display, surface->gem_handle);
+
     free(surface);
 }
 
@@ -509,528 +1195,3214 @@ out:
     return 0;
 }
 
-void* go2_surface_map(go2_surface_t* surface)
+static uint8_t* go2_surface_mapping_get(go2_surface_t* surface)
 {
     if (surface->is_mapped)
         return surface->map;
 
 
+    // mmap offsets must be page aligned, so imported buffers are mapped
+    // from the start and the plane offset applied to the pointer.
     int prime_fd = go2_surface_prime_fd(surface);
-    surface->map = mmap(NULL, surface->size, PROT_READ | PROT_WRITE, MAP_SHARED, prime_fd, 0);
-    if (surface->map == MAP_FAILED)
+    uint8_t* map = mmap(NULL, surface->offset + surface->size, PROT_READ | PROT_WRITE, MAP_SHARED, prime_fd, 0);
+    if (map == MAP_FAILED)
     {
         printf("mmap failed.\n");
         return NULL;
     }
 
+    surface->map = map + surface->offset;
     surface->is_mapped = true;
     return surface->map;
 }
 
+static void go2_surface_shadow_flush(go2_surface_t* surface);
+
+void* go2_surface_map(go2_surface_t* surface)
+{
+    go2_surface_shadow_flush(surface);
+
+    return go2_surface_mapping_get(surface);
+}
+
 void go2_surface_unmap(go2_surface_t* surface)
 {
+    go2_surface_shadow_flush(surface);
+
     if (surface->is_mapped)
     {
-        munmap(surface->map, surface->size);
+        munmap(surface->map - surface->offset, surface->offset + surface->size);
 
         surface->is_mapped = false;
         surface->map = NULL;
     }
 }
 
-
-static uint32_t go2_rkformat_get(uint32_t drm_fourcc)
+static void go2_surface_dma_sync(go2_surface_t* surface, uint64_t flags)
 {
-    switch (drm_fourcc)
-    {
-        case DRM_FORMAT_RGBA8888:
-            return RK_FORMAT_RGBA_8888;
-    
-        case DRM_FORMAT_RGBX8888:
-            return RK_FORMAT_RGBX_8888;
-    
-        case DRM_FORMAT_RGB888:
-            return RK_FORMAT_RGB_888;
-    
-        case DRM_FORMAT_ARGB8888:
-        case DRM_FORMAT_XRGB8888:
-            return RK_FORMAT_BGRA_8888;
-    
-        case DRM_FORMAT_RGB565:
-            return RK_FORMAT_RGB_565;
+    static bool warned;
 
-        case DRM_FORMAT_RGBA5551:
-            return RK_FORMAT_RGBA_5551;
-    
-        case DRM_FORMAT_RGBA4444:
-            return RK_FORMAT_RGBA_4444;
+    struct dma_buf_sync sync = { 0 };
+    sync.flags = flags;
 
-        case DRM_FORMAT_BGR888:
-            return RK_FORMAT_BGR_888;
-    
-        default:
-            printf("RKFORMAT not supported. ");
-            printf("drm_fourcc=%c%c%c%c\n", drm_fourcc & 0xff, drm_fourcc >> 8 & 0xff, drm_fourcc >> 16 & 0xff, drm_fourcc >> 24);
-            return 0;
+    int io = drmIoctl(go2_surface_prime_fd(surface), DMA_BUF_IOCTL_SYNC, &sync);
+    if (io < 0 && !warned)
+    {
+        printf("DMA_BUF_IOCTL_SYNC failed.\n");
+        warned = true;
     }
 }
 
-void go2_surface_blit(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
-                      go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
-                      go2_rotation_t rotation)
+// Writes rows changed in the shadow copy back to the scanout buffer.
+// Called with shadow_mutex held.
+static void go2_surface_shadow_write_back(go2_surface_t* surface)
 {
-    rga_info_t dst = { 0 };
-    dst.fd = go2_surface_prime_fd(dstSurface);
-    dst.mmuFlag = 1;
-    dst.rect.xoffset = dstX;
-    dst.rect.yoffset = dstY;
-    dst.rect.width = dstWidth;
-    dst.rect.height = dstHeight;
-    dst.rect.wstride = dstSurface->stride / (go2_drm_format_get_bpp(dstSurface->format) / 8);
-    dst.rect.hstride = dstSurface->height;
-    dst.rect.format = go2_rkformat_get(dstSurface->format);
-
-    rga_info_t src = { 0 };
-    src.fd = go2_surface_prime_fd(srcSurface);
-    src.mmuFlag = 1;
+    if (!surface->shadow || surface->dirty_top >= surface->dirty_bottom)
+    {
+        return;
+    }
 
-    switch (rotation)
+    uint8_t* map = go2_surface_mapping_get(surface);
+    if (!map)
     {
-        case GO2_ROTATION_DEGREES_0:
-            src.rotation = 0;
-            break;
+        return;
+    }
 
-        case GO2_ROTATION_DEGREES_90:
-            src.rotation = HAL_TRANSFORM_ROT_90;
-            break;
+    size_t offset = (size_t)surface->dirty_top * surface->stride;
+    size_t size = (size_t)(surface->dirty_bottom - surface->dirty_top) * surface->stride;
 
-        case GO2_ROTATION_DEGREES_180:
-            src.rotation = HAL_TRANSFORM_ROT_180;
-            break;
+    go2_surface_dma_sync(surface, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+    memcpy(map + offset, surface->shadow + offset, size);
+    go2_surface_dma_sync(surface, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
 
-        case GO2_ROTATION_DEGREES_270:
-            src.rotation = HAL_TRANSFORM_ROT_270;
-            break;
+    surface->dirty_top = surface->dirty_bottom = 0;
+}
 
-        default:
-            printf("rotation not supported.\n");
-            return;
+static void go2_surface_shadow_flush(go2_surface_t* surface)
+{
+    pthread_mutex_lock(&surface->shadow_mutex);
+    go2_surface_shadow_write_back(surface);
+    pthread_mutex_unlock(&surface->shadow_mutex);
+}
+
+static int go2_surface_shadow_load(go2_surface_t* surface)
+{
+    uint8_t* map = go2_surface_mapping_get(surface);
+    if (!map)
+    {
+        return -1;
     }
 
-    src.rect.xoffset = srcX;
-    src.rect.yoffset = srcY;
-    src.rect.width = srcWidth;
-    src.rect.height = srcHeight;
-    src.rect.wstride = srcSurface->stride / (go2_drm_format_get_bpp(srcSurface->format) / 8);
-    src.rect.hstride = srcSurface->height;
-    src.rect.format = go2_rkformat_get(srcSurface->format);
+    go2_surface_dma_sync(surface, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    memcpy(surface->shadow, map, (size_t)surface->stride * surface->height);
+    go2_surface_dma_sync(surface, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
 
-#if 0
-    enum
-    {
-        CATROM    = 0x0,
-        MITCHELL  = 0x1,
-        HERMITE   = 0x2,
-        B_SPLINE  = 0x3,
-    };  /*bicubic coefficient*/
-#endif
-    src.scale_mode = 2;
+    surface->shadow_valid = true;
+    return 0;
+}
 
+// Called before the blitter reads src and writes dst outside the shadow copy
+static void go2_surface_shadow_sync(go2_surface_t* srcSurface, go2_surface_t* dstSurface)
+{
+    if (srcSurface)
+    {
+        go2_surface_shadow_flush(srcSurface);
+    }
 
-    int ret = c_RkRgaBlit(&src, &dst, NULL);
-    if (ret)
+    if (dstSurface)
     {
-        printf("c_RkRgaBlit failed.\n");        
+        pthread_mutex_lock(&dstSurface->shadow_mutex);
+
+        if (dstSurface->shadow)
+        {
+            go2_surface_shadow_write_back(dstSurface);
+            dstSurface->shadow_valid = false;
+        }
+
+        pthread_mutex_unlock(&dstSurface->shadow_mutex);
     }
 }
 
-int go2_surface_save_as_png(go2_surface_t* surface, const char* filename)
+int go2_surface_shadow_set(go2_surface_t* surface, bool enabled)
 {
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-    png_bytep* row_pointers = NULL;
+    int result = 0;
 
+    pthread_mutex_lock(&surface->shadow_mutex);
 
-    png_byte color_type = 0;
-    png_byte bit_depth = 0;    
-    switch (surface->format)
-    {     
-        case DRM_FORMAT_RGBA8888:
-            color_type = PNG_COLOR_TYPE_RGBA;
-            bit_depth = 8;
-            break;
-    
-        case DRM_FORMAT_RGB888:
-            color_type = PNG_COLOR_TYPE_RGB;
-            bit_depth = 8;
-            break;
+    if (!enabled)
+    {
+        if (surface->shadow)
+        {
+            go2_surface_shadow_write_back(surface);
 
-        case DRM_FORMAT_RGBX8888:
-        case DRM_FORMAT_RGB565:
-        case DRM_FORMAT_ARGB8888:
-        case DRM_FORMAT_XRGB8888:
-        case DRM_FORMAT_RGBA5551:
-        case DRM_FORMAT_RGBA4444:
-        case DRM_FORMAT_BGR888:
+            free(surface->shadow);
+            surface->shadow = NULL;
+            surface->shadow_valid = false;
+        }
+    }
+    else if (!surface->shadow)
+    {
+        surface->shadow = malloc((size_t)surface->stride * surface->height);
+        if (surface->shadow)
+        {
+            surface->shadow_valid = false;
+            surface->dirty_top = surface->dirty_bottom = 0;
+        }
+        else
+        {
+            printf("malloc failed.\n");
+            result = -1;
+        }
+    }
 
-        default:
-            printf("The image format is not supported.\n");
-            return -2;
+    pthread_mutex_unlock(&surface->shadow_mutex);
+
+    return result;
+}
+
+void* go2_surface_access_begin(go2_surface_t* surface, go2_surface_access_t access)
+{
+    if (surface->access)
+    {
+        printf("go2_surface_access_begin: access already in progress.\n");
+        return NULL;
     }
 
+    pthread_mutex_lock(&surface->shadow_mutex);
+
+    if (surface->shadow)
+    {
+        uint8_t* result = NULL;
+
+        if (surface->shadow_valid || go2_surface_shadow_load(surface) == 0)
+        {
+            surface->access = access;
+            surface->dirty_marked = false;
+            result = surface->shadow;
+        }
+
+        pthread_mutex_unlock(&surface->shadow_mutex);
+        return result;
+    }
 
-    // based on http://zarb.org/~gc/html/libpng.html
+    pthread_mutex_unlock(&surface->shadow_mutex);
 
-    /* create file */
-    FILE *fp = fopen(filename, "wb");
-    if (!fp)
+    uint8_t* map = go2_surface_mapping_get(surface);
+    if (!map)
     {
-        printf("fopen failed. filename='%s'\n", filename);
-        return -1;
+        return NULL;
     }
 
+    uint64_t flags = DMA_BUF_SYNC_START;
+    if (access & GO2_SURFACE_ACCESS_READ) flags |= DMA_BUF_SYNC_READ;
+    if (access & GO2_SURFACE_ACCESS_WRITE) flags |= DMA_BUF_SYNC_WRITE;
+
+    go2_surface_dma_sync(surface, flags);
 
-    /* initialize stuff */
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    surface->access = access;
+    return map;
+}
 
-    if (!png_ptr)
+void go2_surface_dirty_rows_add(go2_surface_t* surface, int y, int height)
+{
+    if (y < 0)
     {
-        printf("png_create_write_struct failed.\n");
-        fclose(fp);
-        return -1;
+        height += y;
+        y = 0;
     }
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
+    if (y + height > surface->height)
     {
-        printf("png_create_info_struct failed.\n");
-        fclose(fp);
-        return -1;
+        height = surface->height - y;
     }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+    if (height <= 0)
     {
-        printf("init_io failed.\n");
-        goto out;
+        return;
     }
 
-    png_init_io(png_ptr, fp);
+    pthread_mutex_lock(&surface->shadow_mutex);
 
+    surface->dirty_marked = true;
 
-    /* write header */
-    if (setjmp(png_jmpbuf(png_ptr)))
-     {
-        printf("write header failed.\n");
-        goto out;
+    if (surface->dirty_top >= surface->dirty_bottom)
+    {
+        surface->dirty_top = y;
+        surface->dirty_bottom = y + height;
+    }
+    else
+    {
+        if (y < surface->dirty_top) surface->dirty_top = y;
+        if (y + height > surface->dirty_bottom) surface->dirty_bottom = y + height;
     }
 
-    png_set_IHDR(png_ptr, info_ptr, surface->width, surface->height,
-                 bit_depth, color_type, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    pthread_mutex_unlock(&surface->shadow_mutex);
+}
+
+void go2_surface_access_end(go2_surface_t* surface)
+{
+    go2_surface_access_t access = surface->access;
+    if (!access)
+    {
+        return;
+    }
 
-    png_write_info(png_ptr, info_ptr);
+    surface->access = 0;
 
+    pthread_mutex_lock(&surface->shadow_mutex);
 
-    /* write bytes */
-    png_bytep src = (png_bytep)go2_surface_map(surface);
-    row_pointers = malloc(sizeof(png_bytep) * surface->height);        
-    for (int y = 0; y < surface->height; ++y)
+    if (surface->shadow)
     {
-        row_pointers[y] = src + (surface->stride * y);
+        // Written rows reach the scanout buffer on the next flush (unmap,
+        // blit or post). A write that marked no rows may have touched any,
+        // whatever earlier accesses left pending.
+        if ((access & GO2_SURFACE_ACCESS_WRITE) && !surface->dirty_marked)
+        {
+            surface->dirty_top = 0;
+            surface->dirty_bottom = surface->height;
+        }
+
+        pthread_mutex_unlock(&surface->shadow_mutex);
+        return;
     }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+    pthread_mutex_unlock(&surface->shadow_mutex);
+
+    uint64_t flags = DMA_BUF_SYNC_END;
+    if (access & GO2_SURFACE_ACCESS_READ) flags |= DMA_BUF_SYNC_READ;
+    if (access & GO2_SURFACE_ACCESS_WRITE) flags |= DMA_BUF_SYNC_WRITE;
+
+    go2_surface_dma_sync(surface, flags);
+}
+
+
+static uint32_t go2_rkformat_find(uint32_t drm_fourcc)
+{
+    switch (drm_fourcc)
     {
-        printf("writing bytes failed.\n");
-        goto out;
+        case DRM_FORMAT_RGBA8888:
+            return RK_FORMAT_RGBA_8888;
+    
+        case DRM_FORMAT_RGBX8888:
+            return RK_FORMAT_RGBX_8888;
+    
+        case DRM_FORMAT_RGB888:
+            return RK_FORMAT_RGB_888;
+    
+        case DRM_FORMAT_ARGB8888:
+        case DRM_FORMAT_XRGB8888:
+            return RK_FORMAT_BGRA_8888;
+    
+        case DRM_FORMAT_RGB565:
+            return RK_FORMAT_RGB_565;
+
+        case DRM_FORMAT_RGBA5551:
+            return RK_FORMAT_RGBA_5551;
+    
+        case DRM_FORMAT_RGBA4444:
+            return RK_FORMAT_RGBA_4444;
+
+        case DRM_FORMAT_BGR888:
+            return RK_FORMAT_BGR_888;
+    
+        default:
+            return 0;
+    }
+}
+
+static uint32_t go2_rkformat_get(uint32_t drm_fourcc)
+{
+    uint32_t result = go2_rkformat_find(drm_fourcc);
+    if (!result)
+    {
+        printf("RKFORMAT not supported. ");
+        printf("drm_fourcc=%c%c%c%c\n", drm_fourcc & 0xff, drm_fourcc >> 8 & 0xff, drm_fourcc >> 16 & 0xff, drm_fourcc >> 24);
+    }
+
+    return result;
+}
+
+// librga is loaded at runtime so the library keeps working (using the
+// software blitter) on systems where it is missing or /dev/rga is unusable.
+typedef int (*rga_init_t)();
+typedef int (*rga_blit_t)(rga_info_t* src, rga_info_t* dst, rga_info_t* src1);
+typedef int (*rga_color_fill_t)(rga_info_t* dst);
+
+static const char* RGA_LIBRARY_NAMES[] = { "librga.so", "librga.so.2", "librga.so.1" };
+static const char* BLITTER_ENV_NAME = "GO2_BLITTER";
+
+static pthread_once_t rga_once = PTHREAD_ONCE_INIT;
+static rga_blit_t rga_blit;
+static rga_color_fill_t rga_color_fill;
+static bool rga_available;
+static go2_blitter_t blitter_requested = GO2_BLITTER_AUTO;
+
+static void go2_rga_load()
+{
+    void* library = NULL;
+    for (int i = 0; i < sizeof(RGA_LIBRARY_NAMES) / sizeof(RGA_LIBRARY_NAMES[0]); ++i)
+    {
+        library = dlopen(RGA_LIBRARY_NAMES[i], RTLD_NOW | RTLD_LOCAL);
+        if (library) break;
+    }
+
+    if (!library)
+    {
+        printf("librga not found, using software blitter.\n");
+        return;
+    }
+
+    rga_init_t rga_init = (rga_init_t)dlsym(library, "c_RkRgaInit");
+    rga_blit = (rga_blit_t)dlsym(library, "c_RkRgaBlit");
+    rga_color_fill = (rga_color_fill_t)dlsym(library, "c_RkRgaColorFill");
+
+    if (!rga_init || !rga_blit || !rga_color_fill)
+    {
+        printf("librga symbols not found, using software blitter.\n");
+        dlclose(library);
+        return;
+    }
+
+    if (rga_init() < 0)
+    {
+        printf("c_RkRgaInit failed, using software blitter.\n");
+        dlclose(library);
+        return;
+    }
+
+    rga_available = true;
+}
+
+static go2_rect_t go2_rect_intersect(const go2_rect_t* a, const go2_rect_t* b)
+{
+    go2_rect_t result;
+
+    int left = (a->x > b->x) ? a->x : b->x;
+    int top = (a->y > b->y) ? a->y : b->y;
+    int right = (a->x + a->width < b->x + b->width) ? a->x + a->width : b->x + b->width;
+    int bottom = (a->y + a->height < b->y + b->height) ? a->y + a->height : b->y + b->height;
+
+    result.x = left;
+    result.y = top;
+    result.width = (right > left) ? right - left : 0;
+    result.height = (bottom > top) ? bottom - top : 0;
+
+    return result;
+}
+
+static int go2_max(int a, int b)
+{
+    return (a > b) ? a : b;
+}
+
+static int go2_min(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+// Clips a blit against both surfaces. Destination pixels outside dstSurface,
+// and those that would sample outside srcSurface, are removed and the source
+// is trimmed to match so the scale is kept. Returns -1 if nothing is left.
+static int go2_blit_clip(go2_surface_t* srcSurface, go2_rect_t* srcRect,
+                         go2_surface_t* dstSurface, go2_rect_t* dstRect,
+                         go2_rotation_t rotation)
+{
+    if (srcRect->width <= 0 || srcRect->height <= 0 || dstRect->width <= 0 || dstRect->height <= 0)
+    {
+        return -1;
+    }
+
+    // Source size once rotated into destination space
+    bool transposed = (rotation == GO2_ROTATION_DEGREES_90 || rotation == GO2_ROTATION_DEGREES_270);
+    int64_t rotatedWidth = transposed ? srcRect->height : srcRect->width;
+    int64_t rotatedHeight = transposed ? srcRect->width : srcRect->height;
+    int64_t dstWidth = dstRect->width;
+    int64_t dstHeight = dstRect->height;
+
+    // Source pixels outside srcSurface on each side
+    int left = go2_max(0, -srcRect->x);
+    int right = go2_max(0, srcRect->x + srcRect->width - srcSurface->width);
+    int top = go2_max(0, -srcRect->y);
+    int bottom = go2_max(0, srcRect->y + srcRect->height - srcSurface->height);
+
+    // The same cuts seen from the destination: left, right, top, bottom
+    int cut[4];
+    switch (rotation)
+    {
+        case GO2_ROTATION_DEGREES_90:
+            cut[0] = bottom; cut[1] = top; cut[2] = left; cut[3] = right;
+            break;
+
+        case GO2_ROTATION_DEGREES_180:
+            cut[0] = right; cut[1] = left; cut[2] = bottom; cut[3] = top;
+            break;
+
+        case GO2_ROTATION_DEGREES_270:
+            cut[0] = top; cut[1] = bottom; cut[2] = right; cut[3] = left;
+            break;
+
+        default:
+            cut[0] = left; cut[1] = right; cut[2] = top; cut[3] = bottom;
+            break;
+    }
+
+    // Destination pixels to drop, rounded up so no sample lands outside
+    int dstLeft = go2_max((cut[0] * dstWidth + rotatedWidth - 1) / rotatedWidth, -dstRect->x);
+    int dstRight = go2_max((cut[1] * dstWidth + rotatedWidth - 1) / rotatedWidth,
+                           dstRect->x + dstRect->width - dstSurface->width);
+    int dstTop = go2_max((cut[2] * dstHeight + rotatedHeight - 1) / rotatedHeight, -dstRect->y);
+    int dstBottom = go2_max((cut[3] * dstHeight + rotatedHeight - 1) / rotatedHeight,
+                            dstRect->y + dstRect->height - dstSurface->height);
+
+    if (dstLeft + dstRight >= dstRect->width || dstTop + dstBottom >= dstRect->height)
+    {
+        return -1;
+    }
+
+    // Rotated source span [x0, x1) x [y0, y1) still covered by the destination
+    int x0 = go2_max(dstLeft * rotatedWidth / dstWidth, cut[0]);
+    int x1 = go2_min(((dstWidth - dstRight) * rotatedWidth + dstWidth - 1) / dstWidth, rotatedWidth - cut[1]);
+    int y0 = go2_max(dstTop * rotatedHeight / dstHeight, cut[2]);
+    int y1 = go2_min(((dstHeight - dstBottom) * rotatedHeight + dstHeight - 1) / dstHeight, rotatedHeight - cut[3]);
+
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return -1;
+    }
+
+    go2_rect_t src = *srcRect;
+    switch (rotation)
+    {
+        case GO2_ROTATION_DEGREES_90:
+            src.x = srcRect->x + y0;
+            src.width = y1 - y0;
+            src.y = srcRect->y + srcRect->height - x1;
+            src.height = x1 - x0;
+            break;
+
+        case GO2_ROTATION_DEGREES_180:
+            src.x = srcRect->x + srcRect->width - x1;
+            src.width = x1 - x0;
+            src.y = srcRect->y + srcRect->height - y1;
+            src.height = y1 - y0;
+            break;
+
+        case GO2_ROTATION_DEGREES_270:
+            src.x = srcRect->x + srcRect->width - y1;
+            src.width = y1 - y0;
+            src.y = srcRect->y + x0;
+            src.height = x1 - x0;
+            break;
+
+        default:
+            src.x = srcRect->x + x0;
+            src.width = x1 - x0;
+            src.y = srcRect->y + y0;
+            src.height = y1 - y0;
+            break;
+    }
+
+    *srcRect = src;
+
+    dstRect->x += dstLeft;
+    dstRect->y += dstTop;
+    dstRect->width -= dstLeft + dstRight;
+    dstRect->height -= dstTop + dstBottom;
+
+    return 0;
+}
+
+// Clips a fill against its surface. Returns -1 if nothing is left.
+static int go2_fill_clip(go2_surface_t* surface, go2_rect_t* rect)
+{
+    go2_rect_t bounds = { 0, 0, surface->width, surface->height };
+
+    *rect = go2_rect_intersect(rect, &bounds);
+
+    return (rect->width > 0 && rect->height > 0) ? 0 : -1;
+}
+
+// RGA addresses a dma-buf from its start, so a plane offset is expressed as
+// extra rows above the surface.
+static int go2_rga_rows_get(go2_surface_t* surface)
+{
+    if (surface->offset % surface->stride)
+    {
+        printf("RGA: offset is not a multiple of stride.\n");
+        return -1;
+    }
+
+    return surface->offset / surface->stride;
+}
+
+static int go2_rga_blit_prepare(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                                go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                                go2_rotation_t rotation, rga_info_t* srcInfo, rga_info_t* dstInfo)
+{
+    int srcRows = go2_rga_rows_get(srcSurface);
+    int dstRows = go2_rga_rows_get(dstSurface);
+    if (srcRows < 0 || dstRows < 0)
+    {
+        return -1;
+    }
+
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+    if (go2_blit_clip(srcSurface, &srcRect, dstSurface, &dstRect, rotation))
+    {
+        return -1;
+    }
+
+    srcX = srcRect.x;
+    srcY = srcRect.y;
+    srcWidth = srcRect.width;
+    srcHeight = srcRect.height;
+    dstX = dstRect.x;
+    dstY = dstRect.y;
+    dstWidth = dstRect.width;
+    dstHeight = dstRect.height;
+
+    rga_info_t dst = { 0 };
+    dst.fd = go2_surface_prime_fd(dstSurface);
+    dst.mmuFlag = 1;
+    dst.rect.xoffset = dstX;
+    dst.rect.yoffset = dstRows + dstY;
+    dst.rect.width = dstWidth;
+    dst.rect.height = dstHeight;
+    dst.rect.wstride = dstSurface->stride / (go2_drm_format_get_bpp(dstSurface->format) / 8);
+    dst.rect.hstride = dstRows + dstSurface->height;
+    dst.rect.format = go2_rkformat_get(dstSurface->format);
+
+    rga_info_t src = { 0 };
+    src.fd = go2_surface_prime_fd(srcSurface);
+    src.mmuFlag = 1;
+
+    switch (rotation)
+    {
+        case GO2_ROTATION_DEGREES_0:
+            src.rotation = 0;
+            break;
+
+        case GO2_ROTATION_DEGREES_90:
+            src.rotation = HAL_TRANSFORM_ROT_90;
+            break;
+
+        case GO2_ROTATION_DEGREES_180:
+            src.rotation = HAL_TRANSFORM_ROT_180;
+            break;
+
+        case GO2_ROTATION_DEGREES_270:
+            src.rotation = HAL_TRANSFORM_ROT_270;
+            break;
+
+        default:
+            printf("rotation not supported.\n");
+            return -1;
+    }
+
+    src.rect.xoffset = srcX;
+    src.rect.yoffset = srcRows + srcY;
+    src.rect.width = srcWidth;
+    src.rect.height = srcHeight;
+    src.rect.wstride = srcSurface->stride / (go2_drm_format_get_bpp(srcSurface->format) / 8);
+    src.rect.hstride = srcRows + srcSurface->height;
+    src.rect.format = go2_rkformat_get(srcSurface->format);
+
+#if 0
+    enum
+    {
+        CATROM    = 0x0,
+        MITCHELL  = 0x1,
+        HERMITE   = 0x2,
+        B_SPLINE  = 0x3,
+    };  /*bicubic coefficient*/
+#endif
+    src.scale_mode = 2;
+
+    // Whole number scale factors (including 1:1) are exact with nearest
+    // sampling (scale_mode 0), which is also cheaper and sharper.
+    bool swapped = (rotation == GO2_ROTATION_DEGREES_90 || rotation == GO2_ROTATION_DEGREES_270);
+    int scaledWidth = swapped ? dstHeight : dstWidth;
+    int scaledHeight = swapped ? dstWidth : dstHeight;
+    if (srcWidth > 0 && srcHeight > 0 &&
+        scaledWidth % srcWidth == 0 && scaledHeight % srcHeight == 0)
+    {
+        src.scale_mode = 0;
+    }
+
+    if (src.fd <= 0 || dst.fd <= 0)
+    {
+        printf("prime fd not available.\n");
+        return -1;
+    }
+
+    *srcInfo = src;
+    *dstInfo = dst;
+
+    return 0;
+}
+
+static int go2_rga_blit_submit(const rga_info_t* srcInfo, const rga_info_t* dstInfo)
+{
+    // librga takes non-const arguments; submit copies so prepared
+    // descriptors can be reused.
+    rga_info_t src = *srcInfo;
+    rga_info_t dst = *dstInfo;
+
+    int ret = rga_blit(&src, &dst, NULL);
+    if (ret)
+    {
+        printf("c_RkRgaBlit failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int go2_rga_blit(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                        go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                        go2_rotation_t rotation)
+{
+    rga_info_t src;
+    rga_info_t dst;
+
+    if (go2_rga_blit_prepare(srcSurface, srcX, srcY, srcWidth, srcHeight,
+                             dstSurface, dstX, dstY, dstWidth, dstHeight,
+                             rotation, &src, &dst))
+    {
+        return -1;
+    }
+
+    return go2_rga_blit_submit(&src, &dst);
+}
+
+// librga blend modes
+#define RGA_BLEND_SRC_OVER (0x0405)                 // straight alpha
+#define RGA_BLEND_SRC_OVER_PREMULTIPLIED (0x0105)
+
+static int go2_rga_blend(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                         go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                         go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha)
+{
+    rga_info_t src;
+    rga_info_t dst;
+
+    if (go2_rga_blit_prepare(srcSurface, srcX, srcY, srcWidth, srcHeight,
+                             dstSurface, dstX, dstY, dstWidth, dstHeight,
+                             rotation, &src, &dst))
+    {
+        return -1;
+    }
+
+    // librga blend word: global alpha in bits 16-23, mode in the low bits.
+    switch (blendMode)
+    {
+        case GO2_BLEND_NONE:
+            break;
+
+        case GO2_BLEND_SRC_OVER:
+            src.blend = ((uint32_t)alpha << 16) | RGA_BLEND_SRC_OVER;
+            break;
+
+        case GO2_BLEND_SRC_OVER_PREMULTIPLIED:
+            src.blend = ((uint32_t)alpha << 16) | RGA_BLEND_SRC_OVER_PREMULTIPLIED;
+            break;
+
+        default:
+            printf("blend mode not supported.\n");
+            return -1;
+    }
+
+    return go2_rga_blit_submit(&src, &dst);
+}
+
+static int go2_rga_fill(go2_surface_t* dstSurface, int x, int y, int width, int height, uint32_t color)
+{
+    int rows = go2_rga_rows_get(dstSurface);
+    if (rows < 0)
+    {
+        return -1;
+    }
+
+    go2_rect_t rect = { x, y, width, height };
+    if (go2_fill_clip(dstSurface, &rect))
+    {
+        return -1;
+    }
+
+    rga_info_t dst = { 0 };
+    dst.fd = go2_surface_prime_fd(dstSurface);
+    dst.mmuFlag = 1;
+    dst.rect.xoffset = rect.x;
+    dst.rect.yoffset = rows + rect.y;
+    dst.rect.width = rect.width;
+    dst.rect.height = rect.height;
+    dst.rect.wstride = dstSurface->stride / (go2_drm_format_get_bpp(dstSurface->format) / 8);
+    dst.rect.hstride = rows + dstSurface->height;
+    dst.rect.format = go2_rkformat_get(dstSurface->format);
+    dst.color = color;
+
+    int ret = rga_color_fill(&dst);
+    if (ret)
+    {
+        printf("c_RkRgaColorFill failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int go2_software_blit(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                             go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                             go2_rotation_t rotation)
+{
+    // The CPU writes straight into the mapping, so never leave the surfaces
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+    if (go2_blit_clip(srcSurface, &srcRect, dstSurface, &dstRect, rotation))
+    {
+        return -1;
+    }
+
+    uint8_t* src = go2_surface_map(srcSurface);
+    uint8_t* dst = go2_surface_map(dstSurface);
+    if (!src || !dst)
+    {
+        printf("go2_software_blit: map failed.\n");
+        return -1;
+    }
+
+    return go2_blitter_sw_blit(src, srcSurface->stride, srcSurface->format, srcRect.x, srcRect.y, srcRect.width, srcRect.height,
+                               dst, dstSurface->stride, dstSurface->format, dstRect.x, dstRect.y, dstRect.width, dstRect.height,
+                               rotation);
+}
+
+static int go2_software_blend(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                              go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                              go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha)
+{
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+    if (go2_blit_clip(srcSurface, &srcRect, dstSurface, &dstRect, rotation))
+    {
+        return -1;
+    }
+
+    uint8_t* src = go2_surface_map(srcSurface);
+    uint8_t* dst = go2_surface_map(dstSurface);
+    if (!src || !dst)
+    {
+        printf("go2_software_blend: map failed.\n");
+        return -1;
+    }
+
+    return go2_blitter_sw_blend(src, srcSurface->stride, srcSurface->format, srcRect.x, srcRect.y, srcRect.width, srcRect.height,
+                                dst, dstSurface->stride, dstSurface->format, dstRect.x, dstRect.y, dstRect.width, dstRect.height,
+                                rotation, blendMode, alpha);
+}
+
+static int go2_software_fill(go2_surface_t* dstSurface, int x, int y, int width, int height, uint32_t color)
+{
+    go2_rect_t rect = { x, y, width, height };
+    if (go2_fill_clip(dstSurface, &rect))
+    {
+        return -1;
+    }
+
+    uint8_t* dst = go2_surface_map(dstSurface);
+    if (!dst)
+    {
+        printf("go2_software_fill: map failed.\n");
+        return -1;
+    }
+
+    return go2_blitter_sw_fill(dst, dstSurface->stride, dstSurface->format, rect.x, rect.y, rect.width, rect.height, color);
+}
+
+
+typedef struct go2_blitter_backend
+{
+    go2_blitter_t type;
+    int (*blit)(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                go2_rotation_t rotation);
+    int (*blend)(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                 go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                 go2_rotation_t rotation, go2_blend_mode_t blendMode, uint8_t alpha);
+    int (*fill)(go2_surface_t* dstSurface, int x, int y, int width, int height, uint32_t color);
+} go2_blitter_backend_t;
+
+static const go2_blitter_backend_t rga_backend = { GO2_BLITTER_RGA, go2_rga_blit, go2_rga_blend, go2_rga_fill };
+static const go2_blitter_backend_t software_backend = { GO2_BLITTER_SOFTWARE, go2_software_blit, go2_software_blend, go2_software_fill };
+
+static const go2_blitter_backend_t* go2_blitter_backend_get()
+{
+    pthread_once(&rga_once, go2_rga_load);
+
+    go2_blitter_t requested = blitter_requested;
+    if (requested == GO2_BLITTER_AUTO)
+    {
+        const char* value = getenv(BLITTER_ENV_NAME);
+        if (value && strcmp(value, "software") == 0)
+        {
+            requested = GO2_BLITTER_SOFTWARE;
+        }
+    }
+
+    if (requested == GO2_BLITTER_SOFTWARE || !rga_available)
+    {
+        return &software_backend;
+    }
+
+    return &rga_backend;
+}
+
+// RGA only handles the formats go2_rkformat_find maps. Operations involving
+// any other format (srcSurface may be NULL for fills) run on the software
+// blitter, which converts every format go2_drm_format_get_bpp knows.
+static const go2_blitter_backend_t* go2_blitter_backend_select(go2_surface_t* srcSurface, go2_surface_t* dstSurface)
+{
+    const go2_blitter_backend_t* backend = go2_blitter_backend_get();
+
+    if (backend->type == GO2_BLITTER_RGA &&
+        ((srcSurface && !go2_rkformat_find(srcSurface->format)) || !go2_rkformat_find(dstSurface->format)))
+    {
+        return &software_backend;
+    }
+
+    return backend;
+}
+
+void go2_blitter_set(go2_blitter_t blitter)
+{
+    blitter_requested = blitter;
+}
+
+go2_blitter_t go2_blitter_get()
+{
+    return go2_blitter_backend_get()->type;
+}
+
+// go2_surface_blit with the backend result, for callers that report it
+static int go2_blit_run(go2_surface_t* srcSurface, const go2_rect_t* srcRect,
+                        go2_surface_t* dstSurface, const go2_rect_t* dstRect,
+                        go2_rotation_t rotation)
+{
+    go2_surface_shadow_sync(srcSurface, dstSurface);
+
+    return go2_blitter_backend_select(srcSurface, dstSurface)->blit(srcSurface, srcRect->x, srcRect->y, srcRect->width, srcRect->height,
+                                                                    dstSurface, dstRect->x, dstRect->y, dstRect->width, dstRect->height,
+                                                                    rotation);
+}
+
+void go2_surface_blit(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                      go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                      go2_rotation_t rotation)
+{
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+
+    go2_blit_run(srcSurface, &srcRect, dstSurface, &dstRect, rotation);
+}
+
+
+typedef struct go2_blit_plan
+{
+    const go2_blitter_backend_t* backend;
+    go2_surface_t* srcSurface;
+    uint32_t srcSerial;
+    go2_rect_t srcRect;
+    go2_surface_t* dstSurface;
+    uint32_t dstSerial;
+    go2_rect_t dstRect;
+    go2_rect_t srcClip;     // srcRect and dstRect clipped to the surfaces
+    go2_rect_t dstClip;
+    go2_rotation_t rotation;
+    bool direct;    // not prepared; executes through go2_surface_blit
+    rga_info_t src;
+    rga_info_t dst;
+} go2_blit_plan_t;
+
+go2_blit_plan_t* go2_blit_plan_create(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                                      go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                                      go2_rotation_t rotation)
+{
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+
+    if (rotation < GO2_ROTATION_DEGREES_0 || rotation > GO2_ROTATION_DEGREES_270)
+    {
+        printf("go2_blit_plan_create: rotation not supported.\n");
+        return NULL;
+    }
+
+    // Partially off-screen blits are planned for their visible part
+    go2_rect_t srcClip = srcRect;
+    go2_rect_t dstClip = dstRect;
+    if (go2_blit_clip(srcSurface, &srcClip, dstSurface, &dstClip, rotation))
+    {
+        printf("go2_blit_plan_create: rectangle out of bounds.\n");
+        return NULL;
+    }
+
+    // The software blitter supports every format; RGA plans fall back to it
+    if (!go2_blitter_sw_format_supported(srcSurface->format) || !go2_blitter_sw_format_supported(dstSurface->format))
+    {
+        printf("go2_blit_plan_create: format not supported.\n");
+        return NULL;
+    }
+
+
+    go2_blit_plan_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->backend = go2_blitter_backend_select(srcSurface, dstSurface);
+    result->srcSurface = srcSurface;
+    result->srcSerial = srcSurface->serial;
+    result->srcRect = srcRect;
+    result->dstSurface = dstSurface;
+    result->dstSerial = dstSurface->serial;
+    result->dstRect = dstRect;
+    result->srcClip = srcClip;
+    result->dstClip = dstClip;
+    result->rotation = rotation;
+
+    if (result->backend->type == GO2_BLITTER_RGA)
+    {
+        if (go2_rga_blit_prepare(srcSurface, srcClip.x, srcClip.y, srcClip.width, srcClip.height,
+                                 dstSurface, dstClip.x, dstClip.y, dstClip.width, dstClip.height,
+                                 rotation, &result->src, &result->dst))
+        {
+            free(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+// Records the parameters of a blit no plan can be built for, so callers
+// that cache plans do not retry (and report) the failure every frame.
+static go2_blit_plan_t* go2_blit_plan_direct_create(go2_surface_t* srcSurface, const go2_rect_t* srcRect,
+                                                    go2_surface_t* dstSurface, const go2_rect_t* dstRect,
+                                                    go2_rotation_t rotation)
+{
+    go2_blit_plan_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->direct = true;
+    result->srcSurface = srcSurface;
+    result->srcSerial = srcSurface->serial;
+    result->srcRect = *srcRect;
+    result->dstSurface = dstSurface;
+    result->dstSerial = dstSurface->serial;
+    result->dstRect = *dstRect;
+    result->rotation = rotation;
+
+    return result;
+}
+
+void go2_blit_plan_destroy(go2_blit_plan_t* plan)
+{
+    free(plan);
+}
+
+int go2_blit_plan_execute(go2_blit_plan_t* plan)
+{
+    if (plan->direct)
+    {
+        return go2_blit_run(plan->srcSurface, &plan->srcRect, plan->dstSurface, &plan->dstRect, plan->rotation);
+    }
+
+    go2_surface_shadow_sync(plan->srcSurface, plan->dstSurface);
+
+    if (plan->backend->type == GO2_BLITTER_RGA)
+    {
+        return go2_rga_blit_submit(&plan->src, &plan->dst);
+    }
+
+    return plan->backend->blit(plan->srcSurface, plan->srcClip.x, plan->srcClip.y, plan->srcClip.width, plan->srcClip.height,
+                               plan->dstSurface, plan->dstClip.x, plan->dstClip.y, plan->dstClip.width, plan->dstClip.height,
+                               plan->rotation);
+}
+
+static bool go2_blit_plan_matches(go2_blit_plan_t* plan, go2_surface_t* srcSurface, const go2_rect_t* srcRect,
+                                  go2_surface_t* dstSurface, const go2_rect_t* dstRect, go2_rotation_t rotation)
+{
+    return plan &&
+           (plan->direct || plan->backend == go2_blitter_backend_select(srcSurface, dstSurface)) &&
+           plan->srcSurface == srcSurface && plan->srcSerial == srcSurface->serial &&
+           plan->dstSurface == dstSurface && plan->dstSerial == dstSurface->serial &&
+           plan->rotation == rotation &&
+           memcmp(&plan->srcRect, srcRect, sizeof(*srcRect)) == 0 &&
+           memcmp(&plan->dstRect, dstRect, sizeof(*dstRect)) == 0;
+}
+
+
+static bool go2_layer_is_opaque(const go2_layer_t* layer)
+{
+    return layer->blend_mode == GO2_BLEND_NONE;
+}
+
+static bool go2_rect_covers(const go2_rect_t* outer, const go2_rect_t* inner)
+{
+    return outer->x <= inner->x &&
+           outer->y <= inner->y &&
+           outer->x + outer->width >= inner->x + inner->width &&
+           outer->y + outer->height >= inner->y + inner->height;
+}
+
+static bool go2_layer_is_visible(const go2_layer_t* layer)
+{
+    return layer->surface && (layer->blend_mode == GO2_BLEND_NONE || layer->alpha != 0);
+}
+
+// Clips a layer to its source surface and the destination. Fails for
+// layers with bad parameters or nothing left on either surface.
+static int go2_layer_clip(const go2_layer_t* layer, go2_surface_t* dstSurface,
+                          go2_rect_t* srcRect, go2_rect_t* dstRect)
+{
+    if (layer->rotation < GO2_ROTATION_DEGREES_0 || layer->rotation > GO2_ROTATION_DEGREES_270 ||
+        layer->blend_mode < GO2_BLEND_NONE || layer->blend_mode > GO2_BLEND_SRC_OVER_PREMULTIPLIED)
+    {
+        return -1;
+    }
+
+    srcRect->x = layer->src_x;
+    srcRect->y = layer->src_y;
+    srcRect->width = layer->src_width;
+    srcRect->height = layer->src_height;
+
+    dstRect->x = layer->dst_x;
+    dstRect->y = layer->dst_y;
+    dstRect->width = layer->dst_width;
+    dstRect->height = layer->dst_height;
+
+    return go2_blit_clip(layer->surface, srcRect, dstSurface, dstRect, layer->rotation);
+}
+
+int go2_surface_compose(go2_surface_t* dstSurface, const go2_layer_t* layers, int count)
+{
+    int result = 0;
+    go2_rect_t srcRect;
+    go2_rect_t dstRect;
+
+    // Validate every layer first so an invalid one leaves dstSurface untouched
+    for (int i = 0; i < count; ++i)
+    {
+        if (go2_layer_is_visible(&layers[i]) &&
+            go2_layer_clip(&layers[i], dstSurface, &srcRect, &dstRect))
+        {
+            printf("go2_surface_compose: layer %d invalid.\n", i);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        const go2_layer_t* layer = &layers[i];
+
+        if (!go2_layer_is_visible(layer))
+        {
+            continue;
+        }
+
+        go2_layer_clip(layer, dstSurface, &srcRect, &dstRect);
+
+        // Skip layers that a later opaque layer completely hides
+        bool hidden = false;
+        for (int j = i + 1; j < count; ++j)
+        {
+            go2_rect_t coverSrc;
+            go2_rect_t coverDst;
+
+            if (go2_layer_is_visible(&layers[j]) && go2_layer_is_opaque(&layers[j]) &&
+                go2_layer_clip(&layers[j], dstSurface, &coverSrc, &coverDst) == 0 &&
+                go2_rect_covers(&coverDst, &dstRect))
+            {
+                hidden = true;
+                break;
+            }
+        }
+
+        if (hidden) continue;
+
+
+        go2_surface_shadow_sync(layer->surface, dstSurface);
+
+        const go2_blitter_backend_t* backend = go2_blitter_backend_select(layer->surface, dstSurface);
+        int ret;
+        if (go2_layer_is_opaque(layer))
+        {
+            ret = backend->blit(layer->surface, srcRect.x, srcRect.y, srcRect.width, srcRect.height,
+                                dstSurface, dstRect.x, dstRect.y, dstRect.width, dstRect.height,
+                                layer->rotation);
+        }
+        else
+        {
+            ret = backend->blend(layer->surface, srcRect.x, srcRect.y, srcRect.width, srcRect.height,
+                                 dstSurface, dstRect.x, dstRect.y, dstRect.width, dstRect.height,
+                                 layer->rotation, layer->blend_mode, layer->alpha);
+        }
+
+        if (ret)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+// Asynchronous blits are executed in order by a single worker thread, which
+// matches the single RGA unit. Completion is signalled through an eventfd so
+// callers can poll it alongside other descriptors.
+typedef struct go2_blit_job
+{
+    struct go2_blit_job* next;
+    go2_blit_plan_t* plan;
+    go2_surface_t* srcSurface;
+    go2_rect_t srcRect;
+    go2_surface_t* dstSurface;
+    go2_rect_t dstRect;
+    go2_rotation_t rotation;
+    int fd;
+    int result;
+} go2_blit_job_t;
+
+static pthread_once_t blit_worker_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t blit_worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blit_worker_cond = PTHREAD_COND_INITIALIZER;
+static go2_blit_job_t* blit_worker_head;
+static go2_blit_job_t* blit_worker_tail;
+static bool blit_worker_running;
+
+static void* go2_blit_worker_loop(void* arg)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&blit_worker_mutex);
+
+        while (!blit_worker_head)
+        {
+            pthread_cond_wait(&blit_worker_cond, &blit_worker_mutex);
+        }
+
+        go2_blit_job_t* job = blit_worker_head;
+        blit_worker_head = job->next;
+        if (!blit_worker_head) blit_worker_tail = NULL;
+
+        pthread_mutex_unlock(&blit_worker_mutex);
+
+
+        if (job->plan)
+        {
+            job->result = go2_blit_plan_execute(job->plan);
+        }
+        else
+        {
+            job->result = go2_blit_run(job->srcSurface, &job->srcRect, job->dstSurface, &job->dstRect, job->rotation);
+        }
+
+        uint64_t value = 1;
+        if (write(job->fd, &value, sizeof(value)) != sizeof(value))
+        {
+            printf("go2_blit_worker: eventfd write failed.\n");
+        }
+    }
+
+    return NULL;
+}
+
+static void go2_blit_worker_start()
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, go2_blit_worker_loop, NULL) == 0)
+    {
+        pthread_detach(thread);
+        blit_worker_running = true;
+    }
+    else
+    {
+        printf("go2_blit_worker: pthread_create failed.\n");
+    }
+}
+
+static go2_blit_job_t* go2_blit_job_submit(go2_blit_job_t* job)
+{
+    pthread_once(&blit_worker_once, go2_blit_worker_start);
+
+    if (job->plan)
+    {
+        go2_surface_shadow_sync(job->plan->srcSurface, job->plan->dstSurface);
+    }
+    else
+    {
+        go2_surface_shadow_sync(job->srcSurface, job->dstSurface);
+    }
+
+    job->fd = eventfd(0, EFD_CLOEXEC);
+    if (job->fd < 0)
+    {
+        printf("eventfd failed.\n");
+        free(job);
+        return NULL;
+    }
+
+    if (!blit_worker_running)
+    {
+        // No worker: complete synchronously so callers still work
+        job->result = job->plan ? go2_blit_plan_execute(job->plan) :
+            go2_blit_run(job->srcSurface, &job->srcRect, job->dstSurface, &job->dstRect, job->rotation);
+
+        uint64_t value = 1;
+        if (write(job->fd, &value, sizeof(value)) != sizeof(value))
+        {
+            printf("eventfd write failed.\n");
+        }
+
+        return job;
+    }
+
+    pthread_mutex_lock(&blit_worker_mutex);
+
+    if (blit_worker_tail)
+    {
+        blit_worker_tail->next = job;
+    }
+    else
+    {
+        blit_worker_head = job;
+    }
+
+    blit_worker_tail = job;
+
+    pthread_cond_signal(&blit_worker_cond);
+    pthread_mutex_unlock(&blit_worker_mutex);
+
+    return job;
+}
+
+go2_blit_job_t* go2_surface_blit_async(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                                       go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                                       go2_rotation_t rotation)
+{
+    go2_blit_job_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->srcSurface = srcSurface;
+    result->srcRect = (go2_rect_t){ srcX, srcY, srcWidth, srcHeight };
+    result->dstSurface = dstSurface;
+    result->dstRect = (go2_rect_t){ dstX, dstY, dstWidth, dstHeight };
+    result->rotation = rotation;
+
+    return go2_blit_job_submit(result);
+}
+
+go2_blit_job_t* go2_blit_plan_execute_async(go2_blit_plan_t* plan)
+{
+    go2_blit_job_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->plan = plan;
+
+    return go2_blit_job_submit(result);
+}
+
+int go2_blit_job_fd_get(go2_blit_job_t* job)
+{
+    return job->fd;
+}
+
+// Waits for a job's completion eventfd: 1 once signalled, 0 on timeout,
+// -1 if poll failed.
+static int go2_job_fd_wait(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { 0 };
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (true)
+    {
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR) continue;
+
+        if (ret < 0)
+        {
+            printf("poll failed.\n");
+            return -1;
+        }
+
+        return ret > 0 ? 1 : 0;
+    }
+}
+
+int go2_blit_job_wait(go2_blit_job_t* job, int timeout_ms)
+{
+    int ret = go2_job_fd_wait(job->fd, timeout_ms);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    return job->result ? -1 : 1;
+}
+
+void go2_blit_job_destroy(go2_blit_job_t* job)
+{
+    // The worker may still reference the job
+    go2_blit_job_wait(job, -1);
+
+    close(job->fd);
+    free(job);
+}
+
+// Copies the surface out of the uncached scanout mapping in one pass so
+// conversion and compression work on cached memory.
+static uint8_t* go2_surface_snapshot(go2_surface_t* surface)
+{
+    uint8_t* src = go2_surface_access_begin(surface, GO2_SURFACE_ACCESS_READ);
+    if (!src)
+    {
+        return NULL;
+    }
+
+    size_t size = (size_t)surface->stride * surface->height;
+    uint8_t* result = malloc(size);
+    if (!result)
+    {
+        printf("malloc failed.\n");
+    }
+    else
+    {
+        memcpy(result, src, size);
+    }
+
+    go2_surface_access_end(surface);
+
+    return result;
+}
+
+int go2_surface_save_as_png(go2_surface_t* surface, const char* filename)
+{
+    uint8_t* pixels = go2_surface_snapshot(surface);
+    if (!pixels)
+    {
+        return -1;
+    }
+
+    int result = go2_png_encode(pixels, surface->width, surface->height, surface->stride, surface->format, filename);
+    free(pixels);
+
+    return result;
+}
+
+// Completion of an asynchronous save, signalled through an eventfd like a
+// blit job.
+typedef struct go2_save_job
+{
+    int fd;
+    int result;
+} go2_save_job_t;
+
+static void go2_save_job_complete(int result, void* data)
+{
+    go2_save_job_t* job = (go2_save_job_t*)data;
+
+    job->result = result;
+
+    uint64_t value = 1;
+    if (write(job->fd, &value, sizeof(value)) != sizeof(value))
+    {
+        printf("eventfd write failed.\n");
+    }
+}
+
+go2_save_job_t* go2_surface_save_as_png_async(go2_surface_t* surface, const char* filename)
+{
+    go2_save_job_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->fd = eventfd(0, EFD_CLOEXEC);
+    if (result->fd < 0)
+    {
+        printf("eventfd failed.\n");
+        goto err_00;
+    }
+
+    uint8_t* pixels = go2_surface_snapshot(surface);
+    if (!pixels)
+    {
+        goto err_01;
+    }
+
+    // Takes the pixels; the job is only completed if it was accepted
+    if (go2_png_encode_async(pixels, surface->width, surface->height, surface->stride, surface->format, filename,
+                             go2_save_job_complete, result) == -2)
+    {
+        goto err_01;
+    }
+
+    return result;
+
+
+err_01:
+    close(result->fd);
+
+err_00:
+    free(result);
+    return NULL;
+}
+
+int go2_save_job_fd_get(go2_save_job_t* job)
+{
+    return job->fd;
+}
+
+int go2_save_job_wait(go2_save_job_t* job, int timeout_ms)
+{
+    int ret = go2_job_fd_wait(job->fd, timeout_ms);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    return job->result ? -1 : 1;
+}
+
+void go2_save_job_destroy(go2_save_job_t* job)
+{
+    // The encoder still completes the job
+    go2_save_job_wait(job, -1);
+
+    close(job->fd);
+    free(job);
+}
+
+void go2_surface_save_as_png_wait()
+{
+    go2_png_wait();
+}
+
+
+go2_frame_buffer_t* go2_frame_buffer_create(go2_surface_t* surface)
+{
+    go2_frame_buffer_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->surface = surface;
+
+    const uint32_t handles[4] = {surface->gem_handle, 0, 0, 0};
+    const uint32_t pitches[4] = {surface->stride, 0, 0, 0};
+    const uint32_t offsets[4] = {surface->offset, 0, 0, 0};
+
+    int ret = drmModeAddFB2(surface->display->fd,
+        surface->width,
+        surface->height,
+        surface->format,
+        handles,
+        pitches,
+        offsets,
+        &result->fb_id,
+        0);
+    if (ret)
+    {
+        printf("drmModeAddFB2 failed.\n");
+        free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+void go2_frame_buffer_destroy(go2_frame_buffer_t* frame_buffer)
+{
+    int ret = drmModeRmFB(frame_buffer->surface->display->fd, frame_buffer->fb_id);
+    if (ret)
+    {
+        printf("drmModeRmFB failed.\n");
+    }
+
+    // Cached frame buffers may still be destroyed by their callers
+    if (frame_buffer->surface->frame_buffer == frame_buffer)
+    {
+        frame_buffer->surface->frame_buffer = NULL;
+    }
+
+    free(frame_buffer);
+}
+
+go2_surface_t* go2_frame_buffer_surface_get(go2_frame_buffer_t* frame_buffer)
+{
+    return frame_buffer->surface;
+}
+
+
+typedef struct go2_surface_pool
+{
+    go2_display_t* display;
+    uint64_t maxBytes;
+    uint64_t idleBytes;
+    go2_surface_t** idle;
+    int idleCount;
+    int idleCapacity;
+    go2_surface_pool_stats_t stats;
+    pthread_mutex_t mutex;
+} go2_surface_pool_t;
+
+
+go2_surface_pool_t* go2_surface_pool_create(go2_display_t* display, uint64_t max_bytes)
+{
+    go2_surface_pool_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->display = display;
+    result->maxBytes = max_bytes;
+
+    pthread_mutex_init(&result->mutex, NULL);
+
+    return result;
+}
+
+// Removes idle surfaces, oldest first, until at most max_bytes remain.
+// Called with the mutex held; the evicted surfaces are returned so they
+// can be destroyed after it is released.
+static go2_surface_t** go2_surface_pool_evict(go2_surface_pool_t* pool, uint64_t max_bytes, int* evicted)
+{
+    int count = 0;
+    uint64_t bytes = pool->idleBytes;
+    while (count < pool->idleCount && bytes > max_bytes)
+    {
+        bytes -= pool->idle[count++]->size;
+    }
+
+    *evicted = 0;
+    if (count == 0)
+    {
+        return NULL;
+    }
+
+    go2_surface_t** result = malloc(count * sizeof(go2_surface_t*));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memcpy(result, pool->idle, count * sizeof(go2_surface_t*));
+
+    pool->idleBytes = bytes;
+    pool->stats.evictions += count;
+    pool->idleCount -= count;
+    memmove(pool->idle, pool->idle + count, pool->idleCount * sizeof(go2_surface_t*));
+
+    *evicted = count;
+    return result;
+}
+
+static void go2_surface_pool_evicted_destroy(go2_surface_t** surfaces, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        go2_surface_destroy(surfaces[i]);
+    }
+
+    free(surfaces);
+}
+
+void go2_surface_pool_destroy(go2_surface_pool_t* pool)
+{
+    int count;
+    pthread_mutex_lock(&pool->mutex);
+    go2_surface_t** evicted = go2_surface_pool_evict(pool, 0, &count);
+    pthread_mutex_unlock(&pool->mutex);
+
+    go2_surface_pool_evicted_destroy(evicted, count);
+
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool->idle);
+    free(pool);
+}
+
+go2_surface_t* go2_surface_pool_acquire(go2_surface_pool_t* pool, int width, int height, uint32_t format)
+{
+    go2_surface_t* result = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    // Most recently released first
+    for (int i = pool->idleCount - 1; i >= 0; --i)
+    {
+        go2_surface_t* surface = pool->idle[i];
+        if (surface->width == width && surface->height == height && surface->format == format)
+        {
+            result = surface;
+
+            pool->idleCount--;
+            memmove(pool->idle + i, pool->idle + i + 1, (pool->idleCount - i) * sizeof(go2_surface_t*));
+            pool->idleBytes -= surface->size;
+            break;
+        }
+    }
+
+    if (result)
+    {
+        pool->stats.hits++;
+    }
+    else
+    {
+        pool->stats.misses++;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+
+    if (!result)
+    {
+        result = go2_surface_create(pool->display, width, height, format);
+    }
+
+    return result;
+}
+
+void go2_surface_pool_release(go2_surface_pool_t* pool, go2_surface_t* surface)
+{
+    if (!surface) return;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (surface->size > pool->maxBytes)
+    {
+        pool->stats.evictions++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        go2_surface_destroy(surface);
+        return;
+    }
+
+    int count;
+    go2_surface_t** evicted = go2_surface_pool_evict(pool, pool->maxBytes - surface->size, &count);
+
+    if (pool->idleCount >= pool->idleCapacity)
+    {
+        int capacity = pool->idleCapacity ? pool->idleCapacity * 2 : 8;
+        go2_surface_t** idle = realloc(pool->idle, capacity * sizeof(go2_surface_t*));
+        if (!idle)
+        {
+            printf("realloc failed.\n");
+            pthread_mutex_unlock(&pool->mutex);
+
+            go2_surface_pool_evicted_destroy(evicted, count);
+            go2_surface_destroy(surface);
+            return;
+        }
+
+        pool->idle = idle;
+        pool->idleCapacity = capacity;
+    }
+
+    pool->idle[pool->idleCount++] = surface;
+    pool->idleBytes += surface->size;
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    go2_surface_pool_evicted_destroy(evicted, count);
+}
+
+go2_frame_buffer_t* go2_surface_pool_frame_buffer_get(go2_surface_pool_t* pool, go2_surface_t* surface)
+{
+    // The frame buffer lives as long as the surface, so recycled surfaces
+    // keep their fb_id.
+    if (!surface->frame_buffer)
+    {
+        surface->frame_buffer = go2_frame_buffer_create(surface);
+    }
+
+    return surface->frame_buffer;
+}
+
+void go2_surface_pool_trim(go2_surface_pool_t* pool, uint64_t max_bytes)
+{
+    int count;
+    pthread_mutex_lock(&pool->mutex);
+    go2_surface_t** evicted = go2_surface_pool_evict(pool, max_bytes, &count);
+    pthread_mutex_unlock(&pool->mutex);
+
+    go2_surface_pool_evicted_destroy(evicted, count);
+}
+
+void go2_surface_pool_stats_get(go2_surface_pool_t* pool, go2_surface_pool_stats_t* stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    *stats = pool->stats;
+    stats->idle_count = pool->idleCount;
+    stats->idle_bytes = pool->idleBytes;
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+
+
+
+
+#if 0
+typedef struct go2_presenter
+{
+    go2_display_t* display;
+    uint32_t format;
+    uint32_t background_color;
+    go2_queue_t* freeFrameBuffers;
+    go2_queue_t* usedFrameBuffers;
+    pthread_mutex_t queueMutex;
+    pthread_t renderThread;
+    sem_t freeSem;
+    sem_t usedSem;
+    volatile bool terminating;
+} go2_presenter_t;
+#endif
+
+#define BUFFER_COUNT (3)
+#define MAILBOX_BUFFER_COUNT (4)
+#define BUFFER_COUNT_MIN (2)
+#define BUFFER_COUNT_MAX (8)
+
+static go2_presenter_buffer_t* go2_presenter_buffer_get(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer)
+{
+    for (int i = 0; i < presenter->bufferCount; ++i)
+    {
+        if (presenter->frameBuffers[i] == frameBuffer)
+        {
+            return &presenter->bufferStates[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t* go2_presenter_timestamps_get(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer)
+{
+    go2_presenter_buffer_t* state = go2_presenter_buffer_get(presenter, frameBuffer);
+    return state ? state->timestamps : frameBuffer->timestamps;
+}
+
+// The overlay plane is only touched by the render thread (or after it has
+// exited), so it never races a page flip.
+static int go2_presenter_overlay_show(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer)
+{
+    go2_display_t* display = presenter->display;
+    const go2_rect_t* src = &frameBuffer->overlay_src;
+    const go2_rect_t* dst = &frameBuffer->overlay_dst;
+
+    go2_display_vblank_wait(display, DRM_VBLANK_RELATIVE, 0);
+    uint32_t sequence = display->vblank_sequence;
+
+    int ret = drmModeSetPlane(display->fd, presenter->overlayPlane, display->crtc_id,
+                              frameBuffer->fb_id, 0,
+                              dst->x, dst->y, dst->width, dst->height,
+                              (uint32_t)src->x << 16, (uint32_t)src->y << 16, (uint32_t)src->width << 16, (uint32_t)src->height << 16);
+    if (ret)
+    {
+        printf("drmModeSetPlane failed, using blit path.\n");
+
+        pthread_mutex_lock(&presenter->queueMutex);
+        presenter->overlayFailed = true;
+        presenter->overlayFailedSerial = frameBuffer->surface->serial;
+        presenter->overlayFailedSrc = *src;
+        presenter->overlayFailedDst = *dst;
+        pthread_mutex_unlock(&presenter->queueMutex);
+        return -1;
+    }
+
+    presenter->overlayActive = true;
+
+    // Legacy SetPlane may return before the vblank that latches the new
+    // buffer; wait for it so overlay frames are paced like page flips.
+    go2_display_vblank_wait(display, DRM_VBLANK_ABSOLUTE, sequence + 1);
+
+    return 0;
+}
+
+static void go2_presenter_overlay_disable(go2_presenter_t* presenter)
+{
+    if (presenter->overlayActive)
+    {
+        drmModeSetPlane(presenter->display->fd, presenter->overlayPlane, presenter->display->crtc_id, 0, 0,
+                        0, 0, 0, 0, 0, 0, 0, 0);
+        presenter->overlayActive = false;
+    }
+}
+
+// Returns the slot held by a frame buffer that has left the screen
+static void go2_presenter_frame_buffer_release(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer)
+{
+    if (frameBuffer->overlay)
+    {
+        pthread_mutex_lock(&presenter->queueMutex);
+        go2_queue_push(presenter->freeOverlayFrames, frameBuffer);
+        pthread_mutex_unlock(&presenter->queueMutex);
+
+        sem_post(&presenter->overlaySem);
+        return;
+    }
+
+    if (frameBuffer->release)
+    {
+        frameBuffer->release(frameBuffer);
+    }
+    else
+    {
+        pthread_mutex_lock(&presenter->queueMutex);
+        go2_queue_push(presenter->freeFrameBuffers, frameBuffer);
+        pthread_mutex_unlock(&presenter->queueMutex);
+    }
+
+    sem_post(&presenter->freeSem);
+}
+
+static uint64_t go2_time_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void go2_presenter_histogram_add(go2_presenter_histogram_t* histogram, uint64_t start, uint64_t end)
+{
+    uint64_t value = (end > start) ? end - start : 0;
+
+    histogram->samples[histogram->count % STATS_WINDOW] = value;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) histogram->max = value;
+}
+
+// Called by the post side once the frame is queued
+static void go2_presenter_stats_posted(go2_presenter_t* presenter, const uint64_t* timestamps)
+{
+    pthread_mutex_lock(&presenter->statsMutex);
+
+    presenter->framesPosted++;
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_ACQUIRE], timestamps[Timestamp_PostEntry], timestamps[Timestamp_Acquired]);
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_FILL], timestamps[Timestamp_Acquired], timestamps[Timestamp_Filled]);
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_BLIT], timestamps[Timestamp_Filled], timestamps[Timestamp_Blitted]);
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_QUEUE], timestamps[Timestamp_Blitted], timestamps[Timestamp_Queued]);
+
+    pthread_mutex_unlock(&presenter->statsMutex);
+}
+
+// Called by the render thread once the flip has completed
+static void go2_presenter_stats_presented(go2_presenter_t* presenter, const uint64_t* timestamps)
+{
+    pthread_mutex_lock(&presenter->statsMutex);
+
+    presenter->framesPresented++;
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_SUBMIT], timestamps[Timestamp_Queued], timestamps[Timestamp_FlipSubmitted]);
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_FLIP], timestamps[Timestamp_FlipSubmitted], timestamps[Timestamp_FlipCompleted]);
+    go2_presenter_histogram_add(&presenter->histograms[GO2_PRESENTER_STAGE_TOTAL], timestamps[Timestamp_PostEntry], timestamps[Timestamp_FlipCompleted]);
+
+    pthread_mutex_unlock(&presenter->statsMutex);
+}
+
+static int go2_compare_uint64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+void go2_presenter_stats_get(go2_presenter_t* presenter, go2_presenter_stats_t* stats)
+{
+    uint64_t samples[STATS_WINDOW];
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&presenter->statsMutex);
+
+    stats->frames_posted = presenter->framesPosted;
+    stats->frames_presented = presenter->framesPresented;
+
+    for (int i = 0; i < GO2_PRESENTER_STAGE_MAX; ++i)
+    {
+        go2_presenter_histogram_t* histogram = &presenter->histograms[i];
+        go2_presenter_stage_stats_t* stage = &stats->stages[i];
+
+        stage->count = histogram->count;
+        stage->total_ns = histogram->total;
+        stage->max_ns = histogram->max;
+
+        int sampleCount = (histogram->count < STATS_WINDOW) ? (int)histogram->count : STATS_WINDOW;
+        if (sampleCount > 0)
+        {
+            memcpy(samples, histogram->samples, sampleCount * sizeof(uint64_t));
+            qsort(samples, sampleCount, sizeof(uint64_t), go2_compare_uint64);
+
+            stage->p50_ns = samples[(sampleCount - 1) * 50 / 100];
+            stage->p95_ns = samples[(sampleCount - 1) * 95 / 100];
+            stage->p99_ns = samples[(sampleCount - 1) * 99 / 100];
+        }
+    }
+
+    pthread_mutex_unlock(&presenter->statsMutex);
+
+    stats->frames_dropped = go2_presenter_dropped_frames_get(presenter);
+}
+
+void go2_presenter_stats_reset(go2_presenter_t* presenter)
+{
+    pthread_mutex_lock(&presenter->statsMutex);
+
+    presenter->framesPosted = 0;
+    presenter->framesPresented = 0;
+    memset(presenter->histograms, 0, sizeof(presenter->histograms));
+
+    pthread_mutex_unlock(&presenter->statsMutex);
+    pthread_mutex_lock(&presenter->queueMutex);
+    presenter->droppedFrames = 0;
+    pthread_mutex_unlock(&presenter->queueMutex);
+}
+
+// Frame capture. Presented frames are copied into a ring of capture surfaces
+// by the render thread and streamed to disk by a writer thread. When the
+// ring is full the frame is dropped rather than delaying presentation.
+typedef struct go2_capture_frame
+{
+    go2_surface_t* surface;
+    uint64_t timestamp;
+    uint32_t sequence;
+} go2_capture_frame_t;
+
+typedef struct go2_capture
+{
+    FILE* file;
+    go2_capture_frame_t* frames;
+    int frameCount;
+    go2_spsc_queue_t* freeFrames;
+    go2_spsc_queue_t* filledFrames;
+    pthread_t writerThread;
+    volatile bool terminating;
+    bool writeFailed;
+    _Atomic uint64_t framesCaptured;
+    _Atomic uint64_t framesWritten;
+    _Atomic uint64_t framesDropped;
+} go2_capture_t;
+
+typedef struct go2_capture_header
+{
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint32_t record_size;
+    uint32_t reserved;
+} go2_capture_header_t;
+
+typedef struct go2_capture_record
+{
+    uint64_t timestamp_ns;
+    uint32_t sequence;
+    uint32_t reserved;
+} go2_capture_record_t;
+
+#define CAPTURE_BUFFER_COUNT (8)
+#define CAPTURE_POLL_MS (100)
+
+static const char CAPTURE_MAGIC[8] = { 'G', 'O', '2', 'C', 'A', 'P', 0, 1 };
+
+
+static void* go2_capture_writer(void* arg)
+{
+    go2_capture_t* capture = (go2_capture_t*)arg;
+
+    while (true)
+    {
+        void* value;
+        if (go2_spsc_queue_pop(capture->filledFrames, &value, CAPTURE_POLL_MS))
+        {
+            if (capture->terminating) break;
+            continue;
+        }
+
+        go2_capture_frame_t* frame = (go2_capture_frame_t*)value;
+        go2_surface_t* surface = frame->surface;
+
+        if (!capture->writeFailed)
+        {
+            go2_capture_record_t record = { 0 };
+            record.timestamp_ns = frame->timestamp;
+            record.sequence = frame->sequence;
+
+            uint8_t* pixels = go2_surface_map(surface);
+            size_t size = (size_t)surface->stride * surface->height;
+
+            if (!pixels ||
+                fwrite(&record, sizeof(record), 1, capture->file) != 1 ||
+                fwrite(pixels, size, 1, capture->file) != 1)
+            {
+                printf("capture write failed.\n");
+                capture->writeFailed = true;
+            }
+        }
+
+        if (capture->writeFailed)
+        {
+            atomic_fetch_add(&capture->framesDropped, 1);
+        }
+        else
+        {
+            atomic_fetch_add(&capture->framesWritten, 1);
+        }
+
+        go2_spsc_queue_push(capture->freeFrames, frame, -1);
+    }
+
+    return NULL;
+}
+
+static void go2_capture_destroy(go2_capture_t* capture)
+{
+    for (int i = 0; i < capture->frameCount; ++i)
+    {
+        if (capture->frames[i].surface)
+        {
+            go2_surface_destroy(capture->frames[i].surface);
+        }
+    }
+
+    if (capture->freeFrames) go2_spsc_queue_destroy(capture->freeFrames);
+    if (capture->filledFrames) go2_spsc_queue_destroy(capture->filledFrames);
+    if (capture->file) fclose(capture->file);
+
+    free(capture->frames);
+    free(capture);
+}
+
+static go2_capture_t* go2_capture_create(go2_presenter_t* presenter, const char* filename, int bufferCount)
+{
+    go2_display_t* display = presenter->display;
+
+
+    go2_capture_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->frameCount = bufferCount > 0 ? bufferCount : CAPTURE_BUFFER_COUNT;
+    result->frames = malloc(result->frameCount * sizeof(*result->frames));
+    if (!result->frames)
+    {
+        printf("malloc failed.\n");
+        goto err_00;
+    }
+
+    memset(result->frames, 0, result->frameCount * sizeof(*result->frames));
+
+    result->freeFrames = go2_spsc_queue_create(result->frameCount);
+    result->filledFrames = go2_spsc_queue_create(result->frameCount);
+    if (!result->freeFrames || !result->filledFrames)
+    {
+        goto err_00;
+    }
+
+    for (int i = 0; i < result->frameCount; ++i)
+    {
+        result->frames[i].surface = go2_surface_create(display, display->width, display->height, presenter->format);
+        if (!result->frames[i].surface)
+        {
+            goto err_00;
+        }
+
+        go2_spsc_queue_push(result->freeFrames, &result->frames[i], 0);
+    }
+
+    result->file = fopen(filename, "wb");
+    if (!result->file)
+    {
+        printf("fopen failed. filename='%s'\n", filename);
+        goto err_00;
+    }
+
+    go2_surface_t* surface = result->frames[0].surface;
+
+    go2_capture_header_t header = { 0 };
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.width = surface->width;
+    header.height = surface->height;
+    header.stride = surface->stride;
+    header.format = surface->format;
+    header.record_size = sizeof(go2_capture_record_t) + surface->stride * surface->height;
+
+    if (fwrite(&header, sizeof(header), 1, result->file) != 1)
+    {
+        printf("capture header write failed.\n");
+        goto err_00;
+    }
+
+    if (pthread_create(&result->writerThread, NULL, go2_capture_writer, result))
+    {
+        printf("pthread_create failed.\n");
+        goto err_00;
+    }
+
+    return result;
+
+
+err_00:
+    go2_capture_destroy(result);
+    return NULL;
+}
+
+// Called on the render thread once a frame is on screen, so its buffers are
+// stable until the next flip completes. A frame on the overlay plane is
+// composed over the primary one as the display controller shows it.
+static void go2_presenter_capture_tee(go2_presenter_t* presenter, go2_frame_buffer_t* primary, go2_frame_buffer_t* overlay, uint64_t timestamp)
+{
+    pthread_mutex_lock(&presenter->captureMutex);
+
+    go2_capture_t* capture = presenter->capture;
+    if (capture)
+    {
+        void* value;
+        if (go2_spsc_queue_pop(capture->freeFrames, &value, 0))
+        {
+            atomic_fetch_add(&capture->framesDropped, 1);
+        }
+        else
+        {
+            go2_capture_frame_t* frame = (go2_capture_frame_t*)value;
+            go2_surface_t* dst = frame->surface;
+
+            if (primary)
+            {
+                go2_surface_t* src = primary->surface;
+
+                go2_surface_blit(src, 0, 0, src->width, src->height,
+                                 dst, 0, 0, dst->width, dst->height,
+                                 GO2_ROTATION_DEGREES_0);
+            }
+
+            if (overlay)
+            {
+                const go2_rect_t* src = &overlay->overlay_src;
+                const go2_rect_t* rect = &overlay->overlay_dst;
+
+                go2_surface_blit(overlay->surface, src->x, src->y, src->width, src->height,
+                                 dst, rect->x, rect->y, rect->width, rect->height,
+                                 GO2_ROTATION_DEGREES_0);
+            }
+
+            frame->timestamp = timestamp;
+            go2_display_vblank_get(presenter->display, &frame->sequence, NULL);
+
+            atomic_fetch_add(&capture->framesCaptured, 1);
+            go2_spsc_queue_push(capture->filledFrames, frame, 0);
+        }
+    }
+
+    pthread_mutex_unlock(&presenter->captureMutex);
+}
+
+int go2_presenter_capture_start(go2_presenter_t* presenter, const char* filename, int buffer_count)
+{
+    go2_capture_t* capture = go2_capture_create(presenter, filename, buffer_count);
+    if (!capture)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&presenter->captureMutex);
+    go2_capture_t* previous = presenter->capture;
+    presenter->capture = capture;
+    pthread_mutex_unlock(&presenter->captureMutex);
+
+    if (previous)
+    {
+        previous->terminating = true;
+        pthread_join(previous->writerThread, NULL);
+        go2_capture_destroy(previous);
+    }
+
+    return 0;
+}
+
+void go2_presenter_capture_stop(go2_presenter_t* presenter)
+{
+    pthread_mutex_lock(&presenter->captureMutex);
+    go2_capture_t* capture = presenter->capture;
+    presenter->capture = NULL;
+    pthread_mutex_unlock(&presenter->captureMutex);
+
+    if (capture)
+    {
+        // The writer drains the frames already captured before exiting
+        capture->terminating = true;
+        pthread_join(capture->writerThread, NULL);
+        go2_capture_destroy(capture);
+    }
+}
+
+void go2_presenter_capture_stats_get(go2_presenter_t* presenter, go2_capture_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&presenter->captureMutex);
+
+    go2_capture_t* capture = presenter->capture;
+    if (capture)
+    {
+        stats->frames_captured = atomic_load(&capture->framesCaptured);
+        stats->frames_written = atomic_load(&capture->framesWritten);
+        stats->frames_dropped = atomic_load(&capture->framesDropped);
+    }
+
+    pthread_mutex_unlock(&presenter->captureMutex);
+}
+
+static void* go2_presenter_renderloop(void* arg)
+{
+    go2_presenter_t* presenter = (go2_presenter_t*)arg;
+    go2_frame_buffer_t* prevFrameBuffer = NULL;     // on the primary plane
+    go2_frame_buffer_t* prevOverlayFrame = NULL;    // on the overlay plane
+
+    presenter->terminating = false;
+    while(!presenter->terminating)
+    {
+        sem_wait(&presenter->usedSem);
+        if(presenter->terminating) break;
+
+
+        pthread_mutex_lock(&presenter->queueMutex);
+
+        if (go2_queue_count_get(presenter->usedFrameBuffers) < 1)
+        {
+            // In mailbox mode the frame this token was posted for may have
+            // been replaced by go2_presenter_post.
+            pthread_mutex_unlock(&presenter->queueMutex);
+            continue;
+        }
+
+        go2_frame_buffer_t* dstFrameBuffer = (go2_frame_buffer_t*)go2_queue_pop(presenter->usedFrameBuffers);
+
+        pthread_mutex_unlock(&presenter->queueMutex);
+
+
+        uint64_t* timestamps = go2_presenter_timestamps_get(presenter, dstFrameBuffer);
+        go2_frame_buffer_t* replaced;
+
+        timestamps[Timestamp_FlipSubmitted] = go2_time_ns();
+        if (dstFrameBuffer->overlay)
+        {
+            if (go2_presenter_overlay_show(presenter, dstFrameBuffer))
+            {
+                go2_presenter_frame_buffer_release(presenter, dstFrameBuffer);
+                continue;
+            }
+
+            replaced = prevOverlayFrame;
+            prevOverlayFrame = dstFrameBuffer;
+        }
+        else
+        {
+            // Blocks until the flip has completed so the previous buffer
+            // is guaranteed to no longer be scanned out.
+            if (go2_display_flip_submit(presenter->display, dstFrameBuffer->fb_id) == 0)
+            {
+                go2_display_flip_wait(presenter->display);
+            }
+
+            // A primary frame replaces whatever the overlay was showing
+            go2_presenter_overlay_disable(presenter);
+            if (prevOverlayFrame)
+            {
+                go2_presenter_frame_buffer_release(presenter, prevOverlayFrame);
+                prevOverlayFrame = NULL;
+            }
+
+            replaced = prevFrameBuffer;
+            prevFrameBuffer = dstFrameBuffer;
+        }
+
+        go2_display_vblank_get(presenter->display, NULL, &timestamps[Timestamp_FlipCompleted]);
+        go2_presenter_stats_presented(presenter, timestamps);
+
+        if (replaced)
+        {
+            go2_presenter_frame_buffer_release(presenter, replaced);
+        }
+
+        // After the release so the copy never delays a waiting post. The
+        // frames on screen stay stable until the next flip completes.
+        go2_presenter_capture_tee(presenter, prevFrameBuffer, prevOverlayFrame, timestamps[Timestamp_FlipCompleted]);
+    }
+
+    if (prevFrameBuffer && prevFrameBuffer->release)
+    {
+        prevFrameBuffer->release(prevFrameBuffer);
+    }
+
+
+    return NULL;
+}
+
+go2_presenter_t* go2_presenter_create_ex(go2_display_t* display, const go2_presenter_attributes_t* attributes)
+{
+    int bufferCount = attributes->buffer_count;
+    if (bufferCount == 0)
+    {
+        bufferCount = (attributes->present_mode == GO2_PRESENT_MODE_MAILBOX) ? MAILBOX_BUFFER_COUNT : BUFFER_COUNT;
+    }
+
+    if (bufferCount < BUFFER_COUNT_MIN || bufferCount > BUFFER_COUNT_MAX)
+    {
+        printf("buffer_count must be between %d and %d.\n", BUFFER_COUNT_MIN, BUFFER_COUNT_MAX);
+        return NULL;
+    }
+
+
+    go2_presenter_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->display = display;
+    result->format = attributes->format;
+    result->background_color = attributes->background_color;
+    result->backgroundMode = attributes->background_mode;
+    result->presentMode = attributes->present_mode;
+    result->bufferCount = bufferCount;
+
+    result->frameBuffers = malloc(bufferCount * sizeof(go2_frame_buffer_t*));
+    result->bufferStates = malloc(bufferCount * sizeof(go2_presenter_buffer_t));
+    result->freeFrameBuffers = go2_queue_create(bufferCount);
+    result->usedFrameBuffers = go2_queue_create(bufferCount * 2);   // primary and overlay frames
+    if (!result->frameBuffers || !result->bufferStates || !result->freeFrameBuffers || !result->usedFrameBuffers)
+    {
+        printf("malloc failed.\n");
+        goto err_00;
+    }
+
+    memset(result->frameBuffers, 0, bufferCount * sizeof(go2_frame_buffer_t*));
+    memset(result->bufferStates, 0, bufferCount * sizeof(go2_presenter_buffer_t));
+
+    int width = go2_display_width_get(display);
+    int height = go2_display_height_get(display);
+
+    for (int i = 0; i < bufferCount; ++i)
+    {
+        go2_surface_t* surface = go2_surface_create(display, width, height, result->format);
+        if (!surface)
+        {
+            goto err_01;
+        }
+
+        go2_frame_buffer_t* frameBuffer = go2_frame_buffer_create(surface);
+        if (!frameBuffer)
+        {
+            go2_surface_destroy(surface);
+            goto err_01;
+        }
+
+        result->frameBuffers[i] = frameBuffer;
+        go2_queue_push(result->freeFrameBuffers, frameBuffer);
+    }
+
+ 
+    sem_init(&result->usedSem, 0, 0);
+    sem_init(&result->freeSem, 0, bufferCount);
+
+    if (attributes->overlay_plane)
+    {
+        result->overlayPlane = go2_display_overlay_plane_find(display, &result->overlayFormats, &result->overlayFormatCount);
+        if (!result->overlayPlane)
+        {
+            printf("no overlay plane available, using blit path.\n");
+        }
+    }
+
+    if (result->overlayPlane)
+    {
+        // Overlay frames wrap the caller's surfaces and have slots of their
+        // own, so the primary buffer under the overlay stays on screen.
+        result->overlayFrames = malloc(bufferCount * sizeof(go2_frame_buffer_t));
+        result->freeOverlayFrames = go2_queue_create(bufferCount);
+        if (!result->overlayFrames || !result->freeOverlayFrames)
+        {
+            printf("malloc failed, using blit path.\n");
+
+            if (result->freeOverlayFrames) go2_queue_destroy(result->freeOverlayFrames);
+            free(result->overlayFrames);
+            free(result->overlayFormats);
+            result->overlayFrames = NULL;
+            result->freeOverlayFrames = NULL;
+            result->overlayFormats = NULL;
+            result->overlayPlane = 0;
+        }
+        else
+        {
+            memset(result->overlayFrames, 0, bufferCount * sizeof(go2_frame_buffer_t));
+
+            for (int i = 0; i < bufferCount; ++i)
+            {
+                result->overlayFrames[i].overlay = true;
+                go2_queue_push(result->freeOverlayFrames, &result->overlayFrames[i]);
+            }
+        }
+    }
+
+    sem_init(&result->overlaySem, 0, result->overlayPlane ? bufferCount : 0);
+
+    pthread_mutex_init(&result->queueMutex, NULL);
+    pthread_mutex_init(&result->statsMutex, NULL);
+    pthread_mutex_init(&result->captureMutex, NULL);
+
+    pthread_create(&result->renderThread, NULL, go2_presenter_renderloop, result);
+
+    return result;
+
+
+err_01:
+    for (int i = 0; i < bufferCount; ++i)
+    {
+        go2_frame_buffer_t* frameBuffer = result->frameBuffers[i];
+        if (!frameBuffer) break;
+
+        go2_surface_t* surface = frameBuffer->surface;
+
+        go2_frame_buffer_destroy(frameBuffer);
+        go2_surface_destroy(surface);
+    }
+
+err_00:
+    if (result->usedFrameBuffers) go2_queue_destroy(result->usedFrameBuffers);
+    if (result->freeFrameBuffers) go2_queue_destroy(result->freeFrameBuffers);
+    free(result->frameBuffers);
+    free(result->bufferStates);
+    free(result);
+
+    return NULL;
+}
+
+go2_presenter_t* go2_presenter_create(go2_display_t* display, uint32_t format, uint32_t background_color)
+{
+    go2_presenter_attributes_t attributes = { 0 };
+    attributes.format = format;
+    attributes.background_color = background_color;
+    attributes.background_mode = GO2_BACKGROUND_FILL;
+    attributes.present_mode = GO2_PRESENT_MODE_FIFO;
+    attributes.buffer_count = BUFFER_COUNT;
+
+    return go2_presenter_create_ex(display, &attributes);
+}
+
+void go2_presenter_destroy(go2_presenter_t* presenter)
+{
+    presenter->terminating = true;
+    sem_post(&presenter->usedSem);
+
+    pthread_join(presenter->renderThread, NULL);
+
+    go2_presenter_overlay_disable(presenter);
+
+    go2_presenter_capture_stop(presenter);
+    pthread_mutex_destroy(&presenter->captureMutex);
+
+    go2_frame_buffer_t* pending;
+    while ((pending = go2_queue_pop(presenter->usedFrameBuffers)) != NULL)
+    {
+        if (pending->release)
+        {
+            pending->release(pending);
+        }
+    }
+
+    pthread_mutex_destroy(&presenter->queueMutex);
+    pthread_mutex_destroy(&presenter->statsMutex);
+
+    sem_destroy(&presenter->freeSem);
+    sem_destroy(&presenter->usedSem);
+    sem_destroy(&presenter->overlaySem);
+
+  
+    // Destroy from the master list so the buffer left on screen is included
+    for (int i = 0; i < presenter->bufferCount; ++i)
+    {
+        go2_frame_buffer_t* frameBuffer = presenter->frameBuffers[i];
+
+        go2_surface_t* surface = frameBuffer->surface;
+
+        go2_frame_buffer_destroy(frameBuffer);
+        go2_surface_destroy(surface);
+    }
+
+    go2_queue_destroy(presenter->usedFrameBuffers);
+    go2_queue_destroy(presenter->freeFrameBuffers);
+    for (int i = 0; i < presenter->bufferCount; ++i)
+    {
+        if (presenter->bufferStates[i].plan)
+        {
+            go2_blit_plan_destroy(presenter->bufferStates[i].plan);
+        }
+    }
+
+    if (presenter->freeOverlayFrames)
+    {
+        go2_queue_destroy(presenter->freeOverlayFrames);
+    }
+
+    free(presenter->overlayFrames);
+    free(presenter->overlayFormats);
+    free(presenter->frameBuffers);
+    free(presenter->bufferStates);
+
+    free(presenter);
+}
+
+void go2_presenter_present_mode_set(go2_presenter_t* presenter, go2_present_mode_t mode)
+{
+    presenter->presentMode = mode;
+}
+
+go2_present_mode_t go2_presenter_present_mode_get(go2_presenter_t* presenter)
+{
+    return presenter->presentMode;
+}
+
+uint64_t go2_presenter_dropped_frames_get(go2_presenter_t* presenter)
+{
+    pthread_mutex_lock(&presenter->queueMutex);
+    uint64_t result = presenter->droppedFrames;
+    pthread_mutex_unlock(&presenter->queueMutex);
+
+    return result;
+}
+
+// Fills only the parts of the frame buffer outside the new destination rectangle
+// that may hold stale content: everything on first use or when the color changed,
+// otherwise just what the previous rectangle covered. The blit overwrites the
+// inside of the rectangle.
+static void go2_presenter_background_fill(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer, const go2_rect_t* dstRect)
+{
+    go2_presenter_buffer_t* damage = go2_presenter_buffer_get(presenter, frameBuffer);
+
+    go2_surface_t* surface = frameBuffer->surface;
+    go2_rect_t bounds = { 0, 0, surface->width, surface->height };
+    go2_rect_t rect = go2_rect_intersect(dstRect, &bounds);
+
+    if (damage && damage->valid &&
+        damage->color == presenter->background_color &&
+        memcmp(&damage->rect, &rect, sizeof(rect)) == 0)
+    {
+        return;
+    }
+
+    go2_rect_t stale = bounds;
+    if (damage && damage->valid && damage->color == presenter->background_color)
+    {
+        stale = damage->rect;
+    }
+
+    go2_rect_t borders[4] =
+    {
+        { 0, 0, bounds.width, rect.y },
+        { 0, rect.y + rect.height, bounds.width, bounds.height - (rect.y + rect.height) },
+        { 0, rect.y, rect.x, rect.height },
+        { rect.x + rect.width, rect.y, bounds.width - (rect.x + rect.width), rect.height }
+    };
+
+    if (rect.width == 0 || rect.height == 0)
+    {
+        borders[0] = bounds;
+        borders[1].height = borders[2].width = borders[3].width = 0;
+    }
+
+    const go2_blitter_backend_t* backend = go2_blitter_backend_select(NULL, surface);
+    for (int i = 0; i < 4; ++i)
+    {
+        go2_rect_t fill = go2_rect_intersect(&borders[i], &stale);
+        if (fill.width > 0 && fill.height > 0)
+        {
+            backend->fill(surface, fill.x, fill.y, fill.width, fill.height, presenter->background_color);
+        }
+    }
+
+    if (damage)
+    {
+        damage->valid = true;
+        damage->rect = rect;
+        damage->color = presenter->background_color;
+    }
+}
+
+// Posts usually repeat the same blit every frame, so a prepared plan is kept
+// per frame buffer and only rebuilt when the parameters change. Partially
+// off-screen blits are clipped by the plan; a post with nothing visible is
+// recorded as a direct plan so the failure is not rebuilt every frame.
+static void go2_presenter_blit(go2_presenter_t* presenter, go2_frame_buffer_t* frameBuffer, go2_surface_t* surface,
+                               int srcX, int srcY, int srcWidth, int srcHeight,
+                               int dstX, int dstY, int dstWidth, int dstHeight,
+                               go2_rotation_t rotation)
+{
+    go2_presenter_buffer_t* state = go2_presenter_buffer_get(presenter, frameBuffer);
+    go2_surface_t* dstSurface = frameBuffer->surface;
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
+
+    if (!go2_blit_plan_matches(state->plan, surface, &srcRect, dstSurface, &dstRect, rotation))
+    {
+        if (state->plan)
+        {
+            go2_blit_plan_destroy(state->plan);
+        }
+
+        state->plan = go2_blit_plan_create(surface, srcX, srcY, srcWidth, srcHeight,
+                                           dstSurface, dstX, dstY, dstWidth, dstHeight,
+                                           rotation);
+
+        if (!state->plan)
+        {
+            state->plan = go2_blit_plan_direct_create(surface, &srcRect, dstSurface, &dstRect, rotation);
+        }
+    }
+
+    if (state->plan)
+    {
+        go2_blit_plan_execute(state->plan);
+    }
+}
+
+// Takes back the oldest frame for the given plane that the render thread
+// has not picked up yet. Frames for the other plane keep their order.
+static go2_frame_buffer_t* go2_presenter_pending_take(go2_presenter_t* presenter, bool overlay)
+{
+    go2_frame_buffer_t* result = NULL;
+
+    pthread_mutex_lock(&presenter->queueMutex);
+
+    int count = go2_queue_count_get(presenter->usedFrameBuffers);
+    for (int i = 0; i < count; ++i)
+    {
+        go2_frame_buffer_t* frameBuffer = go2_queue_pop(presenter->usedFrameBuffers);
+        if (!result && frameBuffer->overlay == overlay)
+        {
+            result = frameBuffer;
+        }
+        else
+        {
+            go2_queue_push(presenter->usedFrameBuffers, frameBuffer);
+        }
+    }
+
+    if (result)
+    {
+        presenter->droppedFrames++;
+    }
+
+    pthread_mutex_unlock(&presenter->queueMutex);
+
+    if (result)
+    {
+        // Consume the token posted for the replaced frame. If the render
+        // thread already took it, it will find the queue short and go back
+        // to waiting.
+        sem_trywait(&presenter->usedSem);
+    }
+
+    return result;
+}
+
+static go2_frame_buffer_t* go2_presenter_mailbox_acquire(go2_presenter_t* presenter)
+{
+    if (sem_trywait(&presenter->freeSem) == 0)
+    {
+        return NULL;
+    }
+
+    // Every buffer is either queued or on screen: take back the oldest
+    // pending frame instead of waiting for scanout.
+    go2_frame_buffer_t* result = go2_presenter_pending_take(presenter, false);
+    if (result)
+    {
+        if (result->release)
+        {
+            // Its slot is reused; a presenter buffer is left in the free queue
+            result->release(result);
+            result = NULL;
+        }
+    }
+    else
+    {
+        // Nothing pending (the render thread holds the remaining buffers)
+        sem_wait(&presenter->freeSem);
+    }
+
+    return result;
+}
+
+// Renders a frame into a presenter buffer and queues it for the render thread.
+// A NULL surface produces a background only frame.
+static void go2_presenter_post_frame(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation)
+{
+    uint64_t postEntry = go2_time_ns();
+    go2_frame_buffer_t* dstFrameBuffer = NULL;
+
+    if (presenter->presentMode == GO2_PRESENT_MODE_MAILBOX)
+    {
+        dstFrameBuffer = go2_presenter_mailbox_acquire(presenter);
+    }
+    else
+    {
+        sem_wait(&presenter->freeSem);
+    }
+
+
+    if (!dstFrameBuffer)
+    {
+        pthread_mutex_lock(&presenter->queueMutex);
+
+        if (go2_queue_count_get(presenter->freeFrameBuffers) < 1)
+        {
+            printf("no framebuffer available.\n");
+            abort();
+        }
+
+        dstFrameBuffer = go2_queue_pop(presenter->freeFrameBuffers);
+
+        pthread_mutex_unlock(&presenter->queueMutex);
     }
 
-    png_write_image(png_ptr, row_pointers);
+    uint64_t* timestamps = go2_presenter_timestamps_get(presenter, dstFrameBuffer);
+    timestamps[Timestamp_PostEntry] = postEntry;
+    timestamps[Timestamp_Acquired] = go2_time_ns();
 
 
-    /* end write */
-    if (setjmp(png_jmpbuf(png_ptr)))
+    if (presenter->backgroundMode == GO2_BACKGROUND_FILL || !surface)
     {
-        printf("end of write failed.\n");
-        goto out;
+        go2_rect_t rect = { dstX, dstY, dstWidth, dstHeight };
+        go2_presenter_background_fill(presenter, dstFrameBuffer, &rect);
     }
 
-    png_write_end(png_ptr, NULL);
+    timestamps[Timestamp_Filled] = go2_time_ns();
 
-    /* cleanup heap allocation */
-    free(row_pointers);
 
-    fclose(fp);
-    return 0;
+    if (surface)
+    {
+        go2_presenter_blit(presenter, dstFrameBuffer, surface, srcX, srcY, srcWidth, srcHeight, dstX, dstY, dstWidth, dstHeight, rotation);
+    }
 
-out:
-    if (info_ptr)
-        png_destroy_info_struct(png_ptr, &info_ptr);
+    timestamps[Timestamp_Blitted] = go2_time_ns();
 
-    if (png_ptr)
-        png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
 
-    if (row_pointers)
-        free(row_pointers);
+    pthread_mutex_lock(&presenter->queueMutex);
+    timestamps[Timestamp_Queued] = go2_time_ns();
+    go2_queue_push(presenter->usedFrameBuffers, dstFrameBuffer);
+    pthread_mutex_unlock(&presenter->queueMutex);
 
-    if (fp)
-        fclose(fp);
+    sem_post(&presenter->usedSem);
 
-    return -1;
+    go2_presenter_stats_posted(presenter, timestamps);
 }
 
-
-go2_frame_buffer_t* go2_frame_buffer_create(go2_surface_t* surface)
+static bool go2_presenter_overlay_supported(go2_presenter_t* presenter, go2_surface_t* surface, const go2_rect_t* srcRect, const go2_rect_t* dstRect, go2_rotation_t rotation)
 {
-    go2_frame_buffer_t* result = malloc(sizeof(*result));
-    if (!result)
+    if (!presenter->overlayPlane || rotation != GO2_ROTATION_DEGREES_0)
     {
-        printf("malloc failed.\n");
-        return NULL;
+        return false;
     }
 
-    memset(result, 0, sizeof(*result));
-
-
-    result->surface = surface;
-
-    const uint32_t handles[4] = {surface->gem_handle, 0, 0, 0};
-    const uint32_t pitches[4] = {surface->stride, 0, 0, 0};
-    const uint32_t offsets[4] = {0, 0, 0, 0};
+    // Do not retry a configuration the plane already rejected
+    pthread_mutex_lock(&presenter->queueMutex);
+    bool failed = presenter->overlayFailed &&
+                  presenter->overlayFailedSerial == surface->serial &&
+                  memcmp(&presenter->overlayFailedSrc, srcRect, sizeof(*srcRect)) == 0 &&
+                  memcmp(&presenter->overlayFailedDst, dstRect, sizeof(*dstRect)) == 0;
+    pthread_mutex_unlock(&presenter->queueMutex);
 
-    int ret = drmModeAddFB2(surface->display->fd,
-        surface->width,
-        surface->height,
-        surface->format,
-        handles,
-        pitches,
-        offsets,
-        &result->fb_id,
-        0);
-    if (ret)
+    if (failed)
     {
-        printf("drmModeAddFB2 failed.\n");
-        free(result);
-        return NULL;
+        return false;
     }
 
-    return result;
-}
-
-void go2_frame_buffer_destroy(go2_frame_buffer_t* frame_buffer)
-{
-    int ret = drmModeRmFB(frame_buffer->surface->display->fd, frame_buffer->fb_id);
-    if (ret)
+    for (int i = 0; i < presenter->overlayFormatCount; ++i)
     {
-        printf("drmModeRmFB failed.\n");
+        if (presenter->overlayFormats[i] == surface->format)
+        {
+            return true;
+        }
     }
 
-    free(frame_buffer);
+    return false;
 }
 
-go2_surface_t* go2_frame_buffer_surface_get(go2_frame_buffer_t* frame_buffer)
+static go2_frame_buffer_t* go2_presenter_overlay_frame_acquire(go2_presenter_t* presenter)
 {
-    return frame_buffer->surface;
-}
-
-
-
+    go2_frame_buffer_t* result = NULL;
 
+    if (presenter->presentMode == GO2_PRESENT_MODE_MAILBOX)
+    {
+        if (sem_trywait(&presenter->overlaySem))
+        {
+            // Replace the oldest pending overlay frame instead of waiting
+            result = go2_presenter_pending_take(presenter, true);
+            if (!result)
+            {
+                sem_wait(&presenter->overlaySem);
+            }
+        }
+    }
+    else
+    {
+        sem_wait(&presenter->overlaySem);
+    }
 
-#if 0
-typedef struct go2_presenter
-{
-    go2_display_t* display;
-    uint32_t format;
-    uint32_t background_color;
-    go2_queue_t* freeFrameBuffers;
-    go2_queue_t* usedFrameBuffers;
-    pthread_mutex_t queueMutex;
-    pthread_t renderThread;
-    sem_t freeSem;
-    sem_t usedSem;
-    volatile bool terminating;
-} go2_presenter_t;
-#endif
+    if (!result)
+    {
+        pthread_mutex_lock(&presenter->queueMutex);
+        result = go2_queue_pop(presenter->freeOverlayFrames);
+        pthread_mutex_unlock(&presenter->queueMutex);
+    }
 
-#define BUFFER_COUNT (3)
+    return result;
+}
 
-static void* go2_presenter_renderloop(void* arg)
+// Queues the caller's surface to be scanned out directly on an overlay
+// plane, letting the display controller scale it. The render thread shows
+// it at the next vblank and holds it until a later frame has replaced it.
+static int go2_presenter_overlay_post(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation)
 {
-    go2_presenter_t* presenter = (go2_presenter_t*)arg;
-    go2_frame_buffer_t* prevFrameBuffer = NULL;
+    go2_rect_t srcRect = { srcX, srcY, srcWidth, srcHeight };
+    go2_rect_t dstRect = { dstX, dstY, dstWidth, dstHeight };
 
-    presenter->terminating = false;
-    while(!presenter->terminating)
+    if (!go2_presenter_overlay_supported(presenter, surface, &srcRect, &dstRect, rotation))
     {
-        sem_wait(&presenter->usedSem);
-        if(presenter->terminating) break;
-
-
-        pthread_mutex_lock(&presenter->queueMutex);
+        return -1;
+    }
 
-        if (go2_queue_count_get(presenter->usedFrameBuffers) < 1)
+    if (!surface->frame_buffer)
+    {
+        surface->frame_buffer = go2_frame_buffer_create(surface);
+        if (!surface->frame_buffer)
         {
-            printf("no framebuffer available.\n");
-            abort();
+            return -1;
         }
+    }
 
-        go2_frame_buffer_t* dstFrameBuffer = (go2_frame_buffer_t*)go2_queue_pop(presenter->usedFrameBuffers);
-
-        pthread_mutex_unlock(&presenter->queueMutex);
+    if (!presenter->overlayPosting)
+    {
+        // Clear whatever the blit path left on the primary plane
+        go2_presenter_post_frame(presenter, NULL, 0, 0, 0, 0, 0, 0, 0, 0, GO2_ROTATION_DEGREES_0);
+        presenter->overlayPosting = true;
+    }
 
+    uint64_t postEntry = go2_time_ns();
 
-        go2_display_present(presenter->display, dstFrameBuffer);
+    go2_frame_buffer_t* frameBuffer = go2_presenter_overlay_frame_acquire(presenter);
+    frameBuffer->surface = surface;
+    frameBuffer->fb_id = surface->frame_buffer->fb_id;
+    frameBuffer->overlay_src = srcRect;
+    frameBuffer->overlay_dst = dstRect;
 
-        if (prevFrameBuffer)
-        {
-            pthread_mutex_lock(&presenter->queueMutex);
-            go2_queue_push(presenter->freeFrameBuffers, prevFrameBuffer);
-            pthread_mutex_unlock(&presenter->queueMutex);
+    // Nothing is filled or copied; those stages are recorded as empty
+    uint64_t* timestamps = frameBuffer->timestamps;
+    timestamps[Timestamp_PostEntry] = postEntry;
+    timestamps[Timestamp_Acquired] = go2_time_ns();
+    timestamps[Timestamp_Filled] = timestamps[Timestamp_Acquired];
+    timestamps[Timestamp_Blitted] = timestamps[Timestamp_Acquired];
 
-            sem_post(&presenter->freeSem);
-        }
+    pthread_mutex_lock(&presenter->queueMutex);
+    timestamps[Timestamp_Queued] = go2_time_ns();
+    go2_queue_push(presenter->usedFrameBuffers, frameBuffer);
+    pthread_mutex_unlock(&presenter->queueMutex);
 
-        prevFrameBuffer = dstFrameBuffer;            
-    }
+    sem_post(&presenter->usedSem);
 
+    go2_presenter_stats_posted(presenter, timestamps);
 
-    return NULL;
+    return 0;
 }
 
-go2_presenter_t* go2_presenter_create(go2_display_t* display, uint32_t format, uint32_t background_color)
+static void go2_context_buffer_release(go2_context_buffer_t* buffer)
 {
-    go2_presenter_t* result = malloc(sizeof(*result));
-    if (!result)
+    if (atomic_fetch_sub(&buffer->holds, 1) == 1)
     {
-        printf("malloc failed.\n");
-        return NULL;
+        gbm_surface_release_buffer(buffer->gbmSurface, buffer->gbmBuffer);
     }
+}
 
-    memset(result, 0, sizeof(*result));
-
-
-    result->display = display;
-    result->format = format;
-    result->background_color = background_color;
-    result->freeFrameBuffers = go2_queue_create(BUFFER_COUNT);
-    result->usedFrameBuffers = go2_queue_create(BUFFER_COUNT);
+static void go2_context_frame_buffer_release(go2_frame_buffer_t* frameBuffer)
+{
+    go2_context_buffer_release((go2_context_buffer_t*)frameBuffer->release_data);
+}
 
-    int width = go2_display_width_get(display);
-    int height = go2_display_height_get(display);
+// GL front buffers that exactly cover the display are flipped to directly
+// instead of being copied into a presenter buffer.
+static int go2_presenter_direct_post(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation)
+{
+    go2_display_t* display = presenter->display;
+    go2_context_buffer_t* buffer = surface->context_buffer;
 
-    for (int i = 0; i < BUFFER_COUNT; ++i)
+    if (!buffer || rotation != GO2_ROTATION_DEGREES_0 ||
+        surface->width != display->width || surface->height != display->height ||
+        srcX != 0 || srcY != 0 || srcWidth != surface->width || srcHeight != surface->height ||
+        dstX != 0 || dstY != 0 || dstWidth != display->width || dstHeight != display->height)
     {
-        go2_surface_t* surface = go2_surface_create(display, width, height, format);
-        go2_frame_buffer_t* frameBuffer = go2_frame_buffer_create(surface);
+        return -1;
+    }
 
-        go2_queue_push(result->freeFrameBuffers, frameBuffer);
+    if (!surface->frame_buffer)
+    {
+        surface->frame_buffer = go2_frame_buffer_create(surface);
+        if (!surface->frame_buffer)
+        {
+            return -1;
+        }
     }
 
- 
-    sem_init(&result->usedSem, 0, 0);
-    sem_init(&result->freeSem, 0, BUFFER_COUNT);
+    // The overlay path may have created the frame buffer without hooks; the
+    // render thread must never return it to the free queue.
+    go2_frame_buffer_t* frameBuffer = surface->frame_buffer;
+    frameBuffer->release = go2_context_frame_buffer_release;
+    frameBuffer->release_data = buffer;
+    uint64_t postEntry = go2_time_ns();
 
-    pthread_mutex_init(&result->queueMutex, NULL);
+    // Take a presenter slot as a normal post would, without its buffer
+    if (presenter->presentMode == GO2_PRESENT_MODE_MAILBOX)
+    {
+        go2_frame_buffer_t* stolen = go2_presenter_mailbox_acquire(presenter);
+        if (stolen)
+        {
+            pthread_mutex_lock(&presenter->queueMutex);
+            go2_queue_push(presenter->freeFrameBuffers, stolen);
+            pthread_mutex_unlock(&presenter->queueMutex);
+        }
+    }
+    else
+    {
+        sem_wait(&presenter->freeSem);
+    }
 
-    pthread_create(&result->renderThread, NULL, go2_presenter_renderloop, result);
+    // Held until the flip that replaces it has completed
+    atomic_fetch_add(&buffer->holds, 1);
 
-    return result;
-}
+    uint64_t* timestamps = frameBuffer->timestamps;
+    timestamps[Timestamp_PostEntry] = postEntry;
+    timestamps[Timestamp_Acquired] = go2_time_ns();
+    timestamps[Timestamp_Filled] = timestamps[Timestamp_Acquired];
+    timestamps[Timestamp_Blitted] = timestamps[Timestamp_Acquired];
+
+    pthread_mutex_lock(&presenter->queueMutex);
+    timestamps[Timestamp_Queued] = go2_time_ns();
+    go2_queue_push(presenter->usedFrameBuffers, frameBuffer);
+    pthread_mutex_unlock(&presenter->queueMutex);
 
-void go2_presenter_destroy(go2_presenter_t* presenter)
-{
-    presenter->terminating = true;
     sem_post(&presenter->usedSem);
 
-    pthread_join(presenter->renderThread, NULL);
-    pthread_mutex_destroy(&presenter->queueMutex);
+    go2_presenter_stats_posted(presenter, timestamps);
 
-    sem_destroy(&presenter->freeSem);
-    sem_destroy(&presenter->usedSem);
+    return 0;
+}
 
-  
-    while(go2_queue_count_get(presenter->usedFrameBuffers) > 0)
+void go2_presenter_post(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation)
+{
+    go2_surface_shadow_sync(surface, NULL);
+
+    // Primary frames hide the overlay once they are on screen
+    if (go2_presenter_direct_post(presenter, surface, srcX, srcY, srcWidth, srcHeight, dstX, dstY, dstWidth, dstHeight, rotation) == 0)
     {
-        go2_frame_buffer_t* frameBuffer = go2_queue_pop(presenter->usedFrameBuffers);
-        
-        go2_surface_t* surface = frameBuffer->surface;
-        
-        go2_frame_buffer_destroy(frameBuffer);
-        go2_surface_destroy(surface);
+        presenter->overlayPosting = false;
+        return;
     }
 
-    while(go2_queue_count_get(presenter->freeFrameBuffers) > 0)
+    if (presenter->overlayPlane)
     {
-        go2_frame_buffer_t* frameBuffer = go2_queue_pop(presenter->freeFrameBuffers);
-        
-        go2_surface_t* surface = frameBuffer->surface;
+        if (go2_presenter_overlay_post(presenter, surface, srcX, srcY, srcWidth, srcHeight, dstX, dstY, dstWidth, dstHeight, rotation) == 0)
+        {
+            return;
+        }
 
-        go2_frame_buffer_destroy(frameBuffer);
-        go2_surface_destroy(surface);
+        presenter->overlayPosting = false;
     }
 
-    free(presenter);
+    go2_presenter_post_frame(presenter, surface, srcX, srcY, srcWidth, srcHeight, dstX, dstY, dstWidth, dstHeight, rotation);
 }
 
-void go2_presenter_post(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation)
+void go2_presenter_viewport_set(go2_presenter_t* presenter, const go2_viewport_t* viewport)
+{
+    presenter->viewport = *viewport;
+    presenter->viewportValid = false;
+}
+
+void go2_presenter_viewport_get(go2_presenter_t* presenter, go2_viewport_t* viewport)
 {
-    sem_wait(&presenter->freeSem);
+    *viewport = presenter->viewport;
+}
 
+// Computes the source crop and destination rectangle for a source size.
+// Sizes are worked out in the rotated (visible) orientation and the result
+// is centered in frame buffer coordinates.
+static void go2_presenter_viewport_update(go2_presenter_t* presenter, int srcWidth, int srcHeight, go2_rotation_t rotation)
+{
+    const go2_viewport_t* viewport = &presenter->viewport;
 
-    pthread_mutex_lock(&presenter->queueMutex);
+    go2_rect_t src;
+    src.x = viewport->overscan_left;
+    src.y = viewport->overscan_top;
+    src.width = srcWidth - viewport->overscan_left - viewport->overscan_right;
+    src.height = srcHeight - viewport->overscan_top - viewport->overscan_bottom;
 
-    if (go2_queue_count_get(presenter->freeFrameBuffers) < 1)
+    if (src.width <= 0 || src.height <= 0)
     {
-        printf("no framebuffer available.\n");
-        abort();
+        printf("viewport: overscan larger than source.\n");
+        src = (go2_rect_t){ 0, 0, srcWidth, srcHeight };
     }
 
-    go2_frame_buffer_t* dstFrameBuffer = go2_queue_pop(presenter->freeFrameBuffers);
+    bool swapped = (rotation == GO2_ROTATION_DEGREES_90 || rotation == GO2_ROTATION_DEGREES_270);
+    int screenWidth = swapped ? presenter->display->height : presenter->display->width;
+    int screenHeight = swapped ? presenter->display->width : presenter->display->height;
 
-    pthread_mutex_unlock(&presenter->queueMutex);
+    int width = screenWidth;
+    int height = screenHeight;
 
+    switch (viewport->mode)
+    {
+        case GO2_VIEWPORT_INTEGER:
+        {
+            int scaleX = screenWidth / src.width;
+            int scaleY = screenHeight / src.height;
+            int scale = scaleX < scaleY ? scaleX : scaleY;
+            if (scale >= 1)
+            {
+                width = src.width * scale;
+                height = src.height * scale;
+                break;
+            }
+
+            // Source larger than the screen: fall back to fit
+        }
+        // fall through
 
-    go2_surface_t* dstSurface = go2_frame_buffer_surface_get(dstFrameBuffer);
+        case GO2_VIEWPORT_FIT:
+        {
+            // Aspect ratio of the displayed image, defaulting to square pixels
+            float aspect = viewport->aspect_ratio > 0 ? viewport->aspect_ratio : (float)src.width / src.height;
+            if (screenWidth >= screenHeight * aspect)
+            {
+                height = screenHeight;
+                width = (int)(screenHeight * aspect + 0.5f);
+            }
+            else
+            {
+                width = screenWidth;
+                height = (int)(screenWidth / aspect + 0.5f);
+            }
+            break;
+        }
 
-    rga_info_t dst = { 0 };
-    dst.fd = go2_surface_prime_fd(dstSurface);
-    dst.mmuFlag = 1;
-    dst.rect.xoffset = 0;
-    dst.rect.yoffset = 0;
-    dst.rect.width = go2_surface_width_get(dstSurface);
-    dst.rect.height = go2_surface_height_get(dstSurface);
-    dst.rect.wstride = go2_surface_stride_get(dstSurface) / (go2_drm_format_get_bpp(go2_surface_format_get(dstSurface)) / 8);
-    dst.rect.hstride = go2_surface_height_get(dstSurface);
-    dst.rect.format = go2_rkformat_get(go2_surface_format_get(dstSurface));
-    dst.color = presenter->background_color;
-
-    int ret = c_RkRgaColorFill(&dst);
-    if (ret)
-    {
-        printf("c_RkRgaColorFill failed.\n");
+        case GO2_VIEWPORT_STRETCH:
+        default:
+            break;
     }
 
+    if (width > screenWidth) width = screenWidth;
+    if (height > screenHeight) height = screenHeight;
 
-    go2_surface_blit(surface, srcX, srcY, srcWidth, srcHeight, dstSurface, dstX, dstY, dstWidth, dstHeight, rotation);
+    int dstWidth = swapped ? height : width;
+    int dstHeight = swapped ? width : height;
 
+    presenter->viewportSrc = src;
+    presenter->viewportDst.x = (presenter->display->width - dstWidth) / 2;
+    presenter->viewportDst.y = (presenter->display->height - dstHeight) / 2;
+    presenter->viewportDst.width = dstWidth;
+    presenter->viewportDst.height = dstHeight;
 
-    pthread_mutex_lock(&presenter->queueMutex);
-    go2_queue_push(presenter->usedFrameBuffers, dstFrameBuffer);
-    pthread_mutex_unlock(&presenter->queueMutex);
-
-    sem_post(&presenter->usedSem);
+    presenter->viewportSrcWidth = srcWidth;
+    presenter->viewportSrcHeight = srcHeight;
+    presenter->viewportRotation = rotation;
+    presenter->viewportValid = true;
 }
 
+void go2_presenter_post_viewport(go2_presenter_t* presenter, go2_surface_t* surface, int srcWidth, int srcHeight, go2_rotation_t rotation)
+{
+    if (!presenter->viewportValid ||
+        presenter->viewportSrcWidth != srcWidth ||
+        presenter->viewportSrcHeight != srcHeight ||
+        presenter->viewportRotation != rotation)
+    {
+        go2_presenter_viewport_update(presenter, srcWidth, srcHeight, rotation);
+    }
+
+    go2_rect_t* src = &presenter->viewportSrc;
+    go2_rect_t* dst = &presenter->viewportDst;
 
+    go2_presenter_post(presenter, surface,
+                       src->x, src->y, src->width, src->height,
+                       dst->x, dst->y, dst->width, dst->height,
+                       rotation);
+}
 
-#define BUFFER_MAX (3)
 
-typedef struct buffer_surface_pair
-{
-    struct gbm_bo* gbmBuffer;
-    go2_surface_t* surface;
-} buffer_surface_pair_t;
 
 typedef struct go2_context
 {
@@ -1044,8 +4416,6 @@ typedef struct go2_context
     EGLSurface eglSurface;
     EGLContext eglContext;
     uint32_t drmFourCC;
-    buffer_surface_pair_t bufferMap[BUFFER_MAX];
-    int bufferCount;
 } go2_context_t;
 
 
@@ -1255,11 +4625,6 @@ void go2_context_destroy(go2_context_t* context)
     eglTerminate(context->eglDisplay);
     gbm_device_destroy(context->gbmDevice);
 
-    for(int i = 0; i < context->bufferCount; ++i)
-    {
-        free(context->bufferMap[i].surface);
-    }
-
     free(context);
 }
 
@@ -1288,6 +4653,31 @@ void go2_context_swap_buffers(go2_context_t* context)
     }
 }
 
+// Called by GBM when the buffer object is destroyed
+static void go2_context_buffer_destroy(struct gbm_bo* bo, void* data)
+{
+    go2_context_buffer_t* buffer = (go2_context_buffer_t*)data;
+
+    if (buffer->surface->frame_buffer)
+    {
+        go2_frame_buffer_destroy(buffer->surface->frame_buffer);
+    }
+
+    go2_surface_unmap(buffer->surface);
+    free(buffer->surface->shadow);
+    pthread_mutex_destroy(&buffer->surface->shadow_mutex);
+
+    if (buffer->surface->prime_fd > 0)
+    {
+        close(buffer->surface->prime_fd);
+    }
+
+    go2_display_gem_reference_release(buffer->surface->display, buffer->surface->gem_handle);
+
+    free(buffer->surface);
+    free(buffer);
+}
+
 go2_surface_t* go2_context_surface_lock(go2_context_t* context)
 {
     struct gbm_bo *bo = gbm_surface_lock_front_buffer(context->gbmSurface);
@@ -1297,26 +4687,19 @@ go2_surface_t* go2_context_surface_lock(go2_context_t* context)
         abort();
     }
 
-    go2_surface_t* surface = NULL;
-    for (int i = 0; i < context->bufferCount; ++i)
-    {
-        buffer_surface_pair_t* pair = &context->bufferMap[i];
-        if (pair->gbmBuffer == bo)
-        {
-            surface = pair->surface;
-            break;
-        }
-    }
-
-    if (!surface)
+    go2_context_buffer_t* buffer = (go2_context_buffer_t*)gbm_bo_get_user_data(bo);
+    if (!buffer)
     {
-        if (context->bufferCount >= BUFFER_MAX)
+        buffer = malloc(sizeof(*buffer));
+        if (!buffer)
         {
-            printf("swap buffers count exceeded.\n");
+            printf("malloc failed.\n");
             abort();
         }
 
-        surface = malloc(sizeof(*surface));
+        memset(buffer, 0, sizeof(*buffer));
+
+        go2_surface_t* surface = malloc(sizeof(*surface));
         if (!surface)
         {
             printf("malloc failed.\n");
@@ -1328,40 +4711,40 @@ go2_surface_t* go2_context_surface_lock(go2_context_t* context)
 
         surface->display = context->display;
         surface->gem_handle = gbm_bo_get_handle(bo).u32;
-        surface->size = gbm_bo_get_stride(bo);
+        surface->size = gbm_bo_get_stride(bo) * gbm_bo_get_height(bo);
         surface->width = gbm_bo_get_width(bo);
         surface->height = gbm_bo_get_height(bo);
         surface->stride = gbm_bo_get_stride(bo);
         surface->format = context->drmFourCC;
+        surface->serial = go2_surface_serial_next();
+        surface->context_buffer = buffer;
+        pthread_mutex_init(&surface->shadow_mutex, NULL);
 
+        // Imports of this bo's dma-buf resolve to the same handle
+        if (go2_display_gem_reference_add(context->display, surface->gem_handle, GO2_GEM_OWNER_GBM))
+        {
+            abort();
+        }
 
-        buffer_surface_pair_t* pair = &context->bufferMap[context->bufferCount++];
-        pair->gbmBuffer = bo;
-        pair->surface = surface;
+        buffer->gbmSurface = context->gbmSurface;
+        buffer->gbmBuffer = bo;
+        buffer->surface = surface;
 
-        //printf("added buffer - bo=%p, count=%d\n", bo, context->bufferCount);
+        gbm_bo_set_user_data(bo, buffer, go2_context_buffer_destroy);
     }
 
-    return surface;
+    atomic_fetch_add(&buffer->holds, 1);
+
+    return buffer->surface;
 }
 
 void go2_context_surface_unlock(go2_context_t* context, go2_surface_t* surface)
 {
-    struct gbm_bo* bo = NULL;
-    for (int i = 0; i < context->bufferCount; ++i)
-    {
-        buffer_surface_pair_t* pair = &context->bufferMap[i];
-        if (pair->surface == surface)
-        {
-            bo = pair->gbmBuffer;
-            break;
-        }
-    }
-
-    if (!bo)
+    if (!surface->context_buffer)
     {
         abort();
     }
 
-    gbm_surface_release_buffer(context->gbmSurface, bo);
+    // Deferred until the flip completes when the presenter scanned it out
+    go2_context_buffer_release(surface->context_buffer);
 }
@@ -20,12 +20,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 
 typedef struct go2_display go2_display_t;
 typedef struct go2_surface go2_surface_t;
 typedef struct go2_frame_buffer go2_frame_buffer_t;
 typedef struct go2_presenter go2_presenter_t;
+typedef struct go2_blit_plan go2_blit_plan_t;
+typedef struct go2_blit_job go2_blit_job_t;
+typedef struct go2_save_job go2_save_job_t;
+typedef struct go2_surface_pool go2_surface_pool_t;
 
 typedef enum go2_rotation
 {
@@ -35,6 +40,140 @@ typedef enum go2_rotation
     GO2_ROTATION_DEGREES_270
 } go2_rotation_t;
 
+typedef enum go2_blend_mode
+{
+    GO2_BLEND_NONE = 0,                 // copy, alpha is ignored
+    GO2_BLEND_SRC_OVER,                 // straight alpha
+    GO2_BLEND_SRC_OVER_PREMULTIPLIED    // premultiplied alpha
+} go2_blend_mode_t;
+
+typedef enum go2_surface_access
+{
+    GO2_SURFACE_ACCESS_READ = (1 << 0),
+    GO2_SURFACE_ACCESS_WRITE = (1 << 1),
+    GO2_SURFACE_ACCESS_READ_WRITE = GO2_SURFACE_ACCESS_READ | GO2_SURFACE_ACCESS_WRITE
+} go2_surface_access_t;
+
+typedef struct go2_layer
+{
+    go2_surface_t* surface;
+    int src_x;
+    int src_y;
+    int src_width;
+    int src_height;
+    int dst_x;
+    int dst_y;
+    int dst_width;
+    int dst_height;
+    go2_rotation_t rotation;
+    uint8_t alpha;      // global alpha multiplied with per pixel alpha
+    go2_blend_mode_t blend_mode;
+} go2_layer_t;
+
+typedef enum go2_blitter
+{
+    GO2_BLITTER_AUTO = 0,
+    GO2_BLITTER_RGA,
+    GO2_BLITTER_SOFTWARE
+} go2_blitter_t;
+
+typedef enum go2_present_mode
+{
+    GO2_PRESENT_MODE_FIFO = 0,
+    GO2_PRESENT_MODE_MAILBOX
+} go2_present_mode_t;
+
+typedef enum go2_background_mode
+{
+    GO2_BACKGROUND_FILL = 0,
+    GO2_BACKGROUND_NONE
+} go2_background_mode_t;
+
+typedef struct go2_presenter_attributes
+{
+    uint32_t format;
+    uint32_t background_color;
+    go2_background_mode_t background_mode;
+    go2_present_mode_t present_mode;
+    int buffer_count;   // 0 = default for present_mode
+    bool overlay_plane; // scan surfaces out on an overlay plane when possible, see go2_presenter_post
+} go2_presenter_attributes_t;
+
+typedef enum go2_viewport_mode
+{
+    GO2_VIEWPORT_STRETCH = 0,   // fill the screen
+    GO2_VIEWPORT_FIT,           // largest size keeping the aspect ratio
+    GO2_VIEWPORT_INTEGER        // largest whole number scale, else fit
+} go2_viewport_mode_t;
+
+typedef struct go2_viewport
+{
+    go2_viewport_mode_t mode;
+    float aspect_ratio;         // displayed width / height for FIT, 0 = square pixels
+    int overscan_left;          // source pixels cropped from each edge
+    int overscan_right;
+    int overscan_top;
+    int overscan_bottom;
+} go2_viewport_t;
+
+typedef struct go2_display_mode
+{
+    int width;
+    int height;
+    uint32_t refresh_mhz;   // clock / (htotal * vtotal), in millihertz
+    uint32_t clock_khz;
+    uint32_t htotal;
+    uint32_t vtotal;
+    bool preferred;
+} go2_display_mode_t;
+
+typedef struct go2_surface_pool_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int idle_count;
+    uint64_t idle_bytes;
+} go2_surface_pool_stats_t;
+
+typedef enum go2_presenter_stage
+{
+    GO2_PRESENTER_STAGE_ACQUIRE = 0,    // post entry -> buffer acquired
+    GO2_PRESENTER_STAGE_FILL,           // buffer acquired -> background filled
+    GO2_PRESENTER_STAGE_BLIT,           // background filled -> blit done
+    GO2_PRESENTER_STAGE_QUEUE,          // blit done -> queued for display
+    GO2_PRESENTER_STAGE_SUBMIT,         // queued -> flip submitted
+    GO2_PRESENTER_STAGE_FLIP,           // flip submitted -> flip completed
+    GO2_PRESENTER_STAGE_TOTAL,          // post entry -> flip completed
+
+    GO2_PRESENTER_STAGE_MAX
+} go2_presenter_stage_t;
+
+typedef struct go2_presenter_stage_stats
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;    // percentiles over the most recent frames
+    uint64_t p95_ns;
+    uint64_t p99_ns;
+} go2_presenter_stage_stats_t;
+
+typedef struct go2_presenter_stats
+{
+    uint64_t frames_posted;
+    uint64_t frames_presented;
+    uint64_t frames_dropped;
+    go2_presenter_stage_stats_t stages[GO2_PRESENTER_STAGE_MAX];
+} go2_presenter_stats_t;
+
+typedef struct go2_capture_stats
+{
+    uint64_t frames_captured;
+    uint64_t frames_written;
+    uint64_t frames_dropped;    // ring full or write error
+} go2_capture_stats_t;
+
 typedef struct go2_context_attributes
 {
     int major;
@@ -59,6 +198,16 @@ void go2_display_destroy(go2_display_t* display);
 int go2_display_width_get(go2_display_t* display);
 int go2_display_height_get(go2_display_t* display);
 void go2_display_present(go2_display_t* display, go2_frame_buffer_t* frame_buffer);
+void go2_display_vblank_get(go2_display_t* display, uint32_t* sequence, uint64_t* timestamp_ns);
+int go2_display_mode_count_get(go2_display_t* display);
+int go2_display_mode_get(go2_display_t* display, int index, go2_display_mode_t* mode);
+int go2_display_mode_current_get(go2_display_t* display);
+// Only modes with the current resolution can be set. The change is applied
+// by the next presented frame.
+int go2_display_mode_set(go2_display_t* display, int index);
+// Returns the mode whose refresh rate best matches refresh_mhz (or a
+// multiple of it), or -1.
+int go2_display_mode_find(go2_display_t* display, uint32_t refresh_mhz);
 uint32_t go2_display_backlight_get(go2_display_t* display);
 void go2_display_backlight_set(go2_display_t* display, uint32_t value);
 
@@ -66,7 +215,14 @@ void go2_display_backlight_set(go2_display_t* display, uint32_t value);
 int go2_drm_format_get_bpp(uint32_t format);
 
 
+void go2_blitter_set(go2_blitter_t blitter);
+go2_blitter_t go2_blitter_get();
+
+
 go2_surface_t* go2_surface_create(go2_display_t* display, int width, int height, uint32_t format);
+// Wraps an external dma-buf without copying. fd is duplicated, so the caller
+// keeps ownership of it; the buffer stays alive until go2_surface_destroy.
+go2_surface_t* go2_surface_import_dmabuf(go2_display_t* display, int fd, int width, int height, int stride, uint32_t offset, uint32_t format);
 void go2_surface_destroy(go2_surface_t* surface);
 int go2_surface_width_get(go2_surface_t* surface);
 int go2_surface_height_get(go2_surface_t* surface);
@@ -76,10 +232,48 @@ go2_display_t* go2_surface_display_get(go2_surface_t* surface);
 int go2_surface_prime_fd(go2_surface_t* surface);
 void* go2_surface_map(go2_surface_t* surface);
 void go2_surface_unmap(go2_surface_t* surface);
+
+// CPU access. With a shadow enabled, begin returns a cached copy of the
+// surface; rows written to it (all rows unless marked with
+// go2_surface_dirty_rows_add) are copied back on unmap, blit or post.
+// Without one, the scanout mapping is returned bracketed by DMA_BUF_IOCTL_SYNC.
+int go2_surface_shadow_set(go2_surface_t* surface, bool enabled);
+void* go2_surface_access_begin(go2_surface_t* surface, go2_surface_access_t access);
+void go2_surface_dirty_rows_add(go2_surface_t* surface, int y, int height);
+void go2_surface_access_end(go2_surface_t* surface);
 void go2_surface_blit(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
                       go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
                       go2_rotation_t rotation);
 int go2_surface_save_as_png(go2_surface_t* surface, const char* filename);
+// Snapshots the surface and encodes it on background threads. The job
+// reports the outcome like a blit job; go2_save_job_destroy waits for it.
+go2_save_job_t* go2_surface_save_as_png_async(go2_surface_t* surface, const char* filename);
+int go2_save_job_fd_get(go2_save_job_t* job);
+int go2_save_job_wait(go2_save_job_t* job, int timeout_ms);
+void go2_save_job_destroy(go2_save_job_t* job);
+// Waits for every pending save
+void go2_surface_save_as_png_wait();
+// Layers are clipped to their surfaces; if any layer is invalid or entirely
+// outside them, nothing is drawn and -1 is returned.
+int go2_surface_compose(go2_surface_t* dstSurface, const go2_layer_t* layers, int count);
+
+
+go2_blit_plan_t* go2_blit_plan_create(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                                      go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                                      go2_rotation_t rotation);
+void go2_blit_plan_destroy(go2_blit_plan_t* plan);
+int go2_blit_plan_execute(go2_blit_plan_t* plan);
+
+
+go2_blit_job_t* go2_surface_blit_async(go2_surface_t* srcSurface, int srcX, int srcY, int srcWidth, int srcHeight,
+                                       go2_surface_t* dstSurface, int dstX, int dstY, int dstWidth, int dstHeight,
+                                       go2_rotation_t rotation);
+go2_blit_job_t* go2_blit_plan_execute_async(go2_blit_plan_t* plan);
+int go2_blit_job_fd_get(go2_blit_job_t* job);
+// Returns 1 once the blit has completed, 0 if timeout_ms expired first and
+// -1 if the blit or the wait failed. timeout_ms: -1 = wait forever.
+int go2_blit_job_wait(go2_blit_job_t* job, int timeout_ms);
+void go2_blit_job_destroy(go2_blit_job_t* job);
 
 
 go2_frame_buffer_t* go2_frame_buffer_create(go2_surface_t* surface);
@@ -87,9 +281,43 @@ void go2_frame_buffer_destroy(go2_frame_buffer_t* frame_buffer);
 go2_surface_t* go2_frame_buffer_surface_get(go2_frame_buffer_t* frame_buffer);
 
 
+go2_surface_pool_t* go2_surface_pool_create(go2_display_t* display, uint64_t max_bytes);
+void go2_surface_pool_destroy(go2_surface_pool_t* pool);
+go2_surface_t* go2_surface_pool_acquire(go2_surface_pool_t* pool, int width, int height, uint32_t format);
+void go2_surface_pool_release(go2_surface_pool_t* pool, go2_surface_t* surface);
+go2_frame_buffer_t* go2_surface_pool_frame_buffer_get(go2_surface_pool_t* pool, go2_surface_t* surface);
+void go2_surface_pool_trim(go2_surface_pool_t* pool, uint64_t max_bytes);
+void go2_surface_pool_stats_get(go2_surface_pool_t* pool, go2_surface_pool_stats_t* stats);
+
+
 go2_presenter_t* go2_presenter_create(go2_display_t* display, uint32_t format, uint32_t background_color);
+go2_presenter_t* go2_presenter_create_ex(go2_display_t* display, const go2_presenter_attributes_t* attributes);
 void go2_presenter_destroy(go2_presenter_t* presenter);
+// Posts are presented in order by the render thread, one per vblank. With
+// overlay_plane set, a surface may be scanned out directly instead of being
+// copied: the presenter then holds it until a later frame has replaced it on
+// screen, and it must not be written or destroyed before then. That is
+// guaranteed once buffer_count further posts have returned.
 void go2_presenter_post(go2_presenter_t* presenter, go2_surface_t* surface, int srcX, int srcY, int srcWidth, int srcHeight, int dstX, int dstY, int dstWidth, int dstHeight, go2_rotation_t rotation);
+void go2_presenter_viewport_set(go2_presenter_t* presenter, const go2_viewport_t* viewport);
+void go2_presenter_viewport_get(go2_presenter_t* presenter, go2_viewport_t* viewport);
+// Posts the srcWidth x srcHeight image at the origin of surface using the
+// viewport. Rectangles are recomputed only when the size or rotation changes.
+void go2_presenter_post_viewport(go2_presenter_t* presenter, go2_surface_t* surface, int srcWidth, int srcHeight, go2_rotation_t rotation);
+void go2_presenter_present_mode_set(go2_presenter_t* presenter, go2_present_mode_t mode);
+go2_present_mode_t go2_presenter_present_mode_get(go2_presenter_t* presenter);
+uint64_t go2_presenter_dropped_frames_get(go2_presenter_t* presenter);
+void go2_presenter_stats_get(go2_presenter_t* presenter, go2_presenter_stats_t* stats);
+void go2_presenter_stats_reset(go2_presenter_t* presenter);
+
+// Records every presented frame to filename. The file starts with a 32 byte
+// header ("GO2CAP\0\1", width, height, stride, format, record size) followed
+// by fixed size records: uint64 timestamp_ns, uint32 vblank sequence,
+// uint32 reserved, then stride * height bytes of pixels.
+// buffer_count: capture ring size, 0 = default.
+int go2_presenter_capture_start(go2_presenter_t* presenter, const char* filename, int buffer_count);
+void go2_presenter_capture_stop(go2_presenter_t* presenter);
+void go2_presenter_capture_stats_get(go2_presenter_t* presenter, go2_capture_stats_t* stats);
 
 
 go2_context_t* go2_context_create(go2_display_t* display, int width, int height, const go2_context_attributes_t* attributes);
@@ -22,19 +22,65 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+#define CACHE_LINE_SIZE (64)
 
 
 typedef struct go2_queue
 {
     int capacity;
-    int count;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
     void** data;
 } go2_queue_t;
 
+typedef struct go2_spsc_queue
+{
+    int capacity;
+    uint32_t mask;
+    void** data;
+
+    // Producer and consumer state live on separate cache lines
+    // so the two threads do not contend on the same line.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail;
+    _Atomic uint32_t producer_waiting;
+    uint32_t cached_head;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head;
+    _Atomic uint32_t consumer_waiting;
+    uint32_t cached_tail;
+} go2_spsc_queue_t;
+
+
+static uint32_t go2_queue_round_up(int capacity)
+{
+    uint32_t result = 1;
+    while (result < (uint32_t)capacity)
+    {
+        result <<= 1;
+    }
+
+    return result;
+}
 
 
 go2_queue_t* go2_queue_create(int capacity)
 {
+    if (capacity < 1)
+    {
+        printf("invalid capacity.\n");
+        return NULL;
+    }
+
     go2_queue_t* result = malloc(sizeof(*result));
     if (!result)
     {
@@ -45,9 +91,12 @@ go2_queue_t* go2_queue_create(int capacity)
     memset(result, 0, sizeof(*result));
 
 
+    uint32_t size = go2_queue_round_up(capacity);
+
     result->capacity = capacity;
-    result->data = malloc(capacity * sizeof(void*));
-    if (!result)
+    result->mask = size - 1;
+    result->data = malloc(size * sizeof(void*));
+    if (!result->data)
     {
         printf("data malloc failed.\n");
         free(result);
@@ -59,47 +108,237 @@ go2_queue_t* go2_queue_create(int capacity)
 
 int go2_queue_count_get(go2_queue_t* queue)
 {
-    return queue->count;
+    return (int)(queue->tail - queue->head);
 }
 
-void go2_queue_push(go2_queue_t* queue, void* value)
+int go2_queue_push(go2_queue_t* queue, void* value)
 {
-    if (queue->count < queue->capacity)
+    if (go2_queue_count_get(queue) >= queue->capacity)
     {
-        queue->data[queue->count] = value;
-        queue->count++;
+        return -1;
     }
-    else
-    {
-        printf("queue is full.\n");
-    }    
+
+    queue->data[queue->tail & queue->mask] = value;
+    queue->tail++;
+
+    return 0;
 }
 
 void* go2_queue_pop(go2_queue_t* queue)
 {
-    void* result;
+    if (queue->tail == queue->head)
+    {
+        return NULL;
+    }
+
+    void* result = queue->data[queue->head & queue->mask];
+    queue->head++;
+
+    return result;
+}
 
-    if (queue->count > 0)
+void go2_queue_destroy(go2_queue_t* queue)
+{
+    free(queue->data);
+    free(queue);
+}
+
+
+static int go2_futex_wait(_Atomic uint32_t* address, uint32_t value, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, (uint32_t*)address, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+static void go2_futex_wake(_Atomic uint32_t* address)
+{
+    syscall(SYS_futex, (uint32_t*)address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void go2_deadline_get(struct timespec* deadline, int timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static int go2_deadline_remaining(const struct timespec* deadline, struct timespec* remaining)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    remaining->tv_sec = deadline->tv_sec - now.tv_sec;
+    remaining->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (remaining->tv_nsec < 0)
+    {
+        remaining->tv_sec--;
+        remaining->tv_nsec += 1000000000L;
+    }
+
+    return (remaining->tv_sec >= 0) ? 0 : -1;
+}
+
+// Blocks until *address no longer holds value. The waiting flag is raised before
+// the final re-check so that the other side's store/flag-load pair (both
+// sequentially consistent) cannot miss us.
+static int go2_spsc_wait(_Atomic uint32_t* address, uint32_t value, _Atomic uint32_t* waiting, int timeout_ms)
+{
+    struct timespec deadline;
+    if (timeout_ms > 0)
+    {
+        go2_deadline_get(&deadline, timeout_ms);
+    }
+
+    int result = 0;
+
+    atomic_store(waiting, 1);
+
+    while (atomic_load(address) == value)
     {
-        result = queue->data[0];
+        struct timespec remaining;
+        struct timespec* timeout = NULL;
+
+        if (timeout_ms == 0)
+        {
+            result = -1;
+            break;
+        }
+        else if (timeout_ms > 0)
+        {
+            if (go2_deadline_remaining(&deadline, &remaining))
+            {
+                result = -1;
+                break;
+            }
 
-        for (int i = 0; i < queue->count - 1; ++i)
+            timeout = &remaining;
+        }
+
+        if (go2_futex_wait(address, value, timeout) < 0 && errno == ETIMEDOUT)
         {
-            queue->data[i] = queue->data[i + 1];
+            result = (atomic_load(address) == value) ? -1 : 0;
+            break;
         }
+    }
+
+    atomic_store(waiting, 0);
+
+    return result;
+}
 
-        queue->count--;
+
+go2_spsc_queue_t* go2_spsc_queue_create(int capacity)
+{
+    if (capacity < 1)
+    {
+        printf("invalid capacity.\n");
+        return NULL;
     }
-    else
+
+    go2_spsc_queue_t* result = aligned_alloc(CACHE_LINE_SIZE, (sizeof(*result) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+    if (!result)
     {
-        printf("queue is empty.\n");
-        result = NULL;
+        printf("malloc failed.\n");
+        return NULL;
     }
-    
+
+    memset(result, 0, sizeof(*result));
+
+
+    uint32_t size = go2_queue_round_up(capacity);
+
+    result->capacity = capacity;
+    result->mask = size - 1;
+    result->data = malloc(size * sizeof(void*));
+    if (!result->data)
+    {
+        printf("data malloc failed.\n");
+        free(result);
+        return NULL;
+    }
+
+    atomic_init(&result->head, 0);
+    atomic_init(&result->tail, 0);
+    atomic_init(&result->producer_waiting, 0);
+    atomic_init(&result->consumer_waiting, 0);
+
     return result;
 }
 
-void go2_queue_destroy(go2_queue_t* queue)
+int go2_spsc_queue_count_get(go2_spsc_queue_t* queue)
+{
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    return (int)(tail - head);
+}
+
+int go2_spsc_queue_push(go2_spsc_queue_t* queue, void* value, int timeout_ms)
+{
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail - queue->cached_head >= (uint32_t)queue->capacity)
+    {
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+        while (tail - queue->cached_head >= (uint32_t)queue->capacity)
+        {
+            if (go2_spsc_wait(&queue->head, queue->cached_head, &queue->producer_waiting, timeout_ms))
+            {
+                return -1;
+            }
+
+            queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        }
+    }
+
+    queue->data[tail & queue->mask] = value;
+    atomic_store(&queue->tail, tail + 1);
+
+    if (atomic_load(&queue->consumer_waiting))
+    {
+        go2_futex_wake(&queue->tail);
+    }
+
+    return 0;
+}
+
+int go2_spsc_queue_pop(go2_spsc_queue_t* queue, void** value, int timeout_ms)
+{
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head == queue->cached_tail)
+    {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+        while (head == queue->cached_tail)
+        {
+            if (go2_spsc_wait(&queue->tail, queue->cached_tail, &queue->consumer_waiting, timeout_ms))
+            {
+                return -1;
+            }
+
+            queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        }
+    }
+
+    *value = queue->data[head & queue->mask];
+    atomic_store(&queue->head, head + 1);
+
+    if (atomic_load(&queue->producer_waiting))
+    {
+        go2_futex_wake(&queue->head);
+    }
+
+    return 0;
+}
+
+void go2_spsc_queue_destroy(go2_spsc_queue_t* queue)
 {
     free(queue->data);
     free(queue);
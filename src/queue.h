@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 typedef struct go2_queue go2_queue_t;
+typedef struct go2_spsc_queue go2_spsc_queue_t;
 
 
 #ifdef __cplusplus
@@ -28,10 +29,18 @@ extern "C" {
 
 go2_queue_t* go2_queue_create(int capacity);
 int go2_queue_count_get(go2_queue_t* queue);
-void go2_queue_push(go2_queue_t* queue, void* value);
+int go2_queue_push(go2_queue_t* queue, void* value);
 void* go2_queue_pop(go2_queue_t* queue);
 void go2_queue_destroy(go2_queue_t* queue);
 
+// Lock-free single producer / single consumer queue.
+// timeout_ms: 0 = do not wait, -1 = wait forever.
+go2_spsc_queue_t* go2_spsc_queue_create(int capacity);
+int go2_spsc_queue_count_get(go2_spsc_queue_t* queue);
+int go2_spsc_queue_push(go2_spsc_queue_t* queue, void* value, int timeout_ms);
+int go2_spsc_queue_pop(go2_spsc_queue_t* queue, void** value, int timeout_ms);
+void go2_spsc_queue_destroy(go2_spsc_queue_t* queue);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,359 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "resample.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+#define CHANNELS (2)
+
+#define SINC_TAPS (16)
+#define SINC_PHASES (256)
+#define SINC_CUTOFF (0.95)
+
+// Input frames needed before and after the integer part of the position.
+#define LINEAR_BEFORE (0)
+#define LINEAR_AFTER (1)
+#define SINC_BEFORE (SINC_TAPS / 2 - 1)
+#define SINC_AFTER (SINC_TAPS / 2)
+
+
+typedef struct go2_resampler
+{
+    go2_resampler_quality_t quality;
+    double ratio;
+    double step;        // input frames per output frame
+    int before;
+    int after;
+
+    // Each phase holds SINC_TAPS coefficients, duplicated so they line up
+    // with interleaved stereo input. Phase SINC_PHASES closes the range for
+    // interpolation between adjacent phases.
+    float* kernel;
+
+    float* history;     // interleaved input, starting 'before' frames ahead of position
+    int count;
+    int capacity;
+    double position;
+
+    // Output computed but not yet returned to the caller
+    short* pending;
+    int pendingCount;
+    int pendingCapacity;
+} go2_resampler_t;
+
+
+static void go2_resampler_kernel_build(go2_resampler_t* resampler, double ratio)
+{
+    double cutoff = SINC_CUTOFF * (ratio < 1.0 ? ratio : 1.0);
+
+    for (int p = 0; p <= SINC_PHASES; ++p)
+    {
+        float* taps = resampler->kernel + p * SINC_TAPS * CHANNELS;
+        double frac = (double)p / SINC_PHASES;
+        double sum = 0;
+
+        for (int j = 0; j < SINC_TAPS; ++j)
+        {
+            double x = (j - SINC_BEFORE) - frac;
+            double t = M_PI * cutoff * x;
+            double sinc = (x == 0) ? 1.0 : sin(t) / t;
+            double w = 0.42 + 0.5 * cos(M_PI * x / (SINC_TAPS / 2)) + 0.08 * cos(2 * M_PI * x / (SINC_TAPS / 2));
+            if (fabs(x) >= SINC_TAPS / 2) w = 0;
+
+            taps[j * CHANNELS] = (float)(sinc * w);
+            sum += sinc * w;
+        }
+
+        // Unity gain at DC for every phase
+        for (int j = 0; j < SINC_TAPS; ++j)
+        {
+            taps[j * CHANNELS] = (float)(taps[j * CHANNELS] / sum);
+            taps[j * CHANNELS + 1] = taps[j * CHANNELS];
+        }
+    }
+}
+
+go2_resampler_t* go2_resampler_create(go2_resampler_quality_t quality, double ratio)
+{
+    if (ratio <= 0)
+    {
+        printf("invalid ratio.\n");
+        return NULL;
+    }
+
+    go2_resampler_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->quality = quality;
+
+    if (quality == GO2_RESAMPLER_SINC)
+    {
+        result->before = SINC_BEFORE;
+        result->after = SINC_AFTER;
+
+        size_t size = (SINC_PHASES + 1) * SINC_TAPS * CHANNELS * sizeof(float);
+        result->kernel = aligned_alloc(16, size);
+        if (!result->kernel)
+        {
+            printf("malloc failed.\n");
+            goto err_00;
+        }
+
+        go2_resampler_kernel_build(result, ratio);
+    }
+    else
+    {
+        result->before = LINEAR_BEFORE;
+        result->after = LINEAR_AFTER;
+    }
+
+    // Start with silence so the first input frame lands on the filter center
+    result->capacity = 1024;
+    result->history = malloc(result->capacity * CHANNELS * sizeof(float));
+    if (!result->history)
+    {
+        printf("malloc failed.\n");
+        goto err_01;
+    }
+
+    memset(result->history, 0, result->before * CHANNELS * sizeof(float));
+    result->count = result->before;
+    result->position = result->before;
+
+    go2_resampler_ratio_set(result, ratio);
+
+    return result;
+
+
+err_01:
+    free(result->kernel);
+
+err_00:
+    free(result);
+    return NULL;
+}
+
+void go2_resampler_destroy(go2_resampler_t* resampler)
+{
+    free(resampler->pending);
+    free(resampler->history);
+    free(resampler->kernel);
+    free(resampler);
+}
+
+void go2_resampler_ratio_set(go2_resampler_t* resampler, double ratio)
+{
+    if (ratio <= 0) return;
+
+    resampler->ratio = ratio;
+    resampler->step = 1.0 / ratio;
+}
+
+double go2_resampler_ratio_get(go2_resampler_t* resampler)
+{
+    return resampler->ratio;
+}
+
+int go2_resampler_output_max(go2_resampler_t* resampler, int frames)
+{
+    double available = resampler->count + frames - resampler->position;
+    return resampler->pendingCount + (int)ceil(available * resampler->ratio) + 1;
+}
+
+
+static inline void go2_resampler_sinc(const go2_resampler_t* resampler, const float* src, double frac, float* out)
+{
+    double phase = frac * SINC_PHASES;
+    int p = (int)phase;
+    float f = (float)(phase - p);
+
+    const float* t0 = resampler->kernel + p * SINC_TAPS * CHANNELS;
+    const float* t1 = t0 + SINC_TAPS * CHANNELS;
+
+#if defined(__ARM_NEON)
+    float32x4_t vf = vdupq_n_f32(f);
+    float32x4_t acc = vdupq_n_f32(0);
+
+    for (int j = 0; j < SINC_TAPS * CHANNELS; j += 4)
+    {
+        float32x4_t a = vld1q_f32(t0 + j);
+        float32x4_t k = vmlaq_f32(a, vsubq_f32(vld1q_f32(t1 + j), a), vf);
+        acc = vmlaq_f32(acc, k, vld1q_f32(src + j));
+    }
+
+    vst1_f32(out, vadd_f32(vget_low_f32(acc), vget_high_f32(acc)));
+
+#elif defined(__SSE2__)
+    __m128 vf = _mm_set1_ps(f);
+    __m128 acc = _mm_setzero_ps();
+
+    for (int j = 0; j < SINC_TAPS * CHANNELS; j += 4)
+    {
+        __m128 a = _mm_load_ps(t0 + j);
+        __m128 k = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(t1 + j), a), vf));
+        acc = _mm_add_ps(acc, _mm_mul_ps(k, _mm_loadu_ps(src + j)));
+    }
+
+    // Lanes hold L, R, L, R partial sums
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    _mm_storel_pi((__m64*)out, acc);
+
+#else
+    float l = 0;
+    float r = 0;
+
+    for (int j = 0; j < SINC_TAPS * CHANNELS; j += 2)
+    {
+        float k = t0[j] + (t1[j] - t0[j]) * f;
+        l += k * src[j];
+        r += k * src[j + 1];
+    }
+
+    out[0] = l;
+    out[1] = r;
+#endif
+}
+
+static inline short go2_resampler_clamp(float value)
+{
+    long v = lrintf(value);
+    if (v > 32767) v = 32767;
+    if (v < -32768) v = -32768;
+
+    return (short)v;
+}
+
+// Produces output into the pending buffer until the input runs out.
+static void go2_resampler_run(go2_resampler_t* resampler)
+{
+    int needed = go2_resampler_output_max(resampler, 0);
+    if (needed > resampler->pendingCapacity)
+    {
+        short* pending = realloc(resampler->pending, needed * CHANNELS * sizeof(short));
+        if (!pending)
+        {
+            printf("malloc failed.\n");
+            return;
+        }
+
+        resampler->pending = pending;
+        resampler->pendingCapacity = needed;
+    }
+
+    short* dst = resampler->pending + resampler->pendingCount * CHANNELS;
+    double position = resampler->position;
+    double step = resampler->step;
+    int last = resampler->count - resampler->after;
+
+    while (true)
+    {
+        int i = (int)position;
+        if (i >= last) break;
+
+        double frac = position - i;
+        const float* src = resampler->history + (i - resampler->before) * CHANNELS;
+        float out[2];
+
+        if (resampler->quality == GO2_RESAMPLER_SINC)
+        {
+            go2_resampler_sinc(resampler, src, frac, out);
+        }
+        else
+        {
+            float f = (float)frac;
+            out[0] = src[0] + (src[2] - src[0]) * f;
+            out[1] = src[1] + (src[3] - src[1]) * f;
+        }
+
+        dst[0] = go2_resampler_clamp(out[0]);
+        dst[1] = go2_resampler_clamp(out[1]);
+        dst += CHANNELS;
+
+        position += step;
+    }
+
+    resampler->pendingCount = (dst - resampler->pending) / CHANNELS;
+
+    // Drop the input no output position can reach any more
+    int discard = (int)position - resampler->before;
+    if (discard > 0)
+    {
+        memmove(resampler->history, resampler->history + discard * CHANNELS,
+                (resampler->count - discard) * CHANNELS * sizeof(float));
+        resampler->count -= discard;
+        position -= discard;
+    }
+
+    resampler->position = position;
+}
+
+int go2_resampler_process(go2_resampler_t* resampler, const short* src, int frames, short* dst, int dstFrames)
+{
+    if (resampler->count + frames > resampler->capacity)
+    {
+        int capacity = resampler->count + frames;
+        float* history = realloc(resampler->history, capacity * CHANNELS * sizeof(float));
+        if (!history)
+        {
+            printf("malloc failed.\n");
+            return -1;
+        }
+
+        resampler->history = history;
+        resampler->capacity = capacity;
+    }
+
+    float* tail = resampler->history + resampler->count * CHANNELS;
+    for (int i = 0; i < frames * CHANNELS; ++i)
+    {
+        tail[i] = src[i];
+    }
+
+    resampler->count += frames;
+
+    go2_resampler_run(resampler);
+
+    int result = resampler->pendingCount < dstFrames ? resampler->pendingCount : dstFrames;
+    memcpy(dst, resampler->pending, result * CHANNELS * sizeof(short));
+
+    resampler->pendingCount -= result;
+    memmove(resampler->pending, resampler->pending + result * CHANNELS,
+            resampler->pendingCount * CHANNELS * sizeof(short));
+
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdint.h>
+
+
+// Stereo S16 sample rate conversion. The ratio (output rate / input rate)
+// may change between calls without clicks, which lets callers steer it
+// from a buffer fill level.
+
+typedef struct go2_resampler go2_resampler_t;
+
+typedef enum go2_resampler_quality
+{
+    GO2_RESAMPLER_LINEAR = 0,
+    GO2_RESAMPLER_SINC          // 16 tap Blackman windowed sinc
+} go2_resampler_quality_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The sinc cutoff follows the nominal ratio given here.
+go2_resampler_t* go2_resampler_create(go2_resampler_quality_t quality, double ratio);
+void go2_resampler_destroy(go2_resampler_t* resampler);
+void go2_resampler_ratio_set(go2_resampler_t* resampler, double ratio);
+double go2_resampler_ratio_get(go2_resampler_t* resampler);
+
+// Upper bound on the frames go2_resampler_process produces for the given input.
+int go2_resampler_output_max(go2_resampler_t* resampler, int frames);
+
+// Consumes every input frame and returns the frames written to dst. Output
+// that does not fit in dstFrames stays buffered for the next call.
+int go2_resampler_process(go2_resampler_t* resampler, const short* src, int frames, short* dst, int dstFrames);
+
+#ifdef __cplusplus
+}
+#endif
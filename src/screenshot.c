@@ -0,0 +1,569 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "screenshot.h"
+#include "blitter.h"
+#include "convert.h"
+
+#include <drm/drm_fourcc.h>
+#include <zlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+#define STRIPE_ROWS (64)
+#define WORKER_COUNT_MAX (4)
+
+
+typedef struct go2_png_stripe
+{
+    struct go2_png_job* job;
+    struct go2_png_stripe* next;
+    int y;
+    int height;
+    uint8_t* data;
+    size_t size;
+    uint32_t adler;
+    int result;
+} go2_png_stripe_t;
+
+typedef struct go2_png_job
+{
+    char* filename;
+    uint8_t* pixels;
+    bool ownsPixels;
+    int width;
+    int height;
+    int stride;
+    uint32_t format;
+    uint32_t pngFormat;
+    int channels;
+    int stripeCount;
+    int stripesRemaining;
+    go2_png_stripe_t* stripes;
+    go2_png_complete_t complete;
+    void* completeData;
+} go2_png_job_t;
+
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_idle_cond = PTHREAD_COND_INITIALIZER;
+static go2_png_stripe_t* pool_head;
+static go2_png_stripe_t* pool_tail;
+static int pool_workers;
+static int pool_jobs;
+
+
+static uint8_t go2_png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Writes the filter type byte followed by the Paeth filtered row
+static void go2_png_row_filter(const uint8_t* row, const uint8_t* prev, int length, int bpp, uint8_t* dst)
+{
+    *dst++ = 4;
+
+    if (!prev)
+    {
+        // Paeth against a zero row reduces to Sub
+        for (int i = 0; i < bpp; ++i) dst[i] = row[i];
+        for (int i = bpp; i < length; ++i) dst[i] = row[i] - row[i - bpp];
+        return;
+    }
+
+    for (int i = 0; i < bpp; ++i) dst[i] = row[i] - prev[i];
+    for (int i = bpp; i < length; ++i) dst[i] = row[i] - go2_png_paeth(row[i - bpp], prev[i], prev[i - bpp]);
+}
+
+static void go2_png_stripe_encode(go2_png_stripe_t* stripe)
+{
+    go2_png_job_t* job = stripe->job;
+    int rowLength = job->width * job->channels;
+    int first = stripe->y > 0 ? stripe->y - 1 : 0;
+    int rows = stripe->y + stripe->height - first;
+
+    stripe->result = -1;
+
+    // Converted rows, including the row above the stripe used by the filter
+    uint8_t* converted = malloc((size_t)rowLength * rows);
+    uint8_t* filtered = malloc((size_t)(rowLength + 1) * stripe->height);
+    if (!converted || !filtered)
+    {
+        printf("malloc failed.\n");
+        goto out;
+    }
+
+    if (go2_blitter_sw_blit(job->pixels, job->stride, job->format, 0, first, job->width, rows,
+                            converted, rowLength, job->pngFormat, 0, 0, job->width, rows,
+                            GO2_ROTATION_DEGREES_0))
+    {
+        printf("format conversion failed.\n");
+        goto out;
+    }
+
+    for (int y = 0; y < stripe->height; ++y)
+    {
+        int row = stripe->y + y - first;
+        const uint8_t* prev = row > 0 ? converted + (size_t)(row - 1) * rowLength : NULL;
+
+        go2_png_row_filter(converted + (size_t)row * rowLength, prev, rowLength, job->channels,
+                           filtered + (size_t)y * (rowLength + 1));
+    }
+
+    size_t filteredSize = (size_t)(rowLength + 1) * stripe->height;
+    stripe->adler = adler32(adler32(0, NULL, 0), filtered, filteredSize);
+
+
+    // Raw deflate. Stripes other than the last end on a byte aligned sync
+    // flush so the streams can be concatenated.
+    z_stream stream = { 0 };
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        printf("deflateInit2 failed.\n");
+        goto out;
+    }
+
+    size_t capacity = deflateBound(&stream, filteredSize) + 16;
+    stripe->data = malloc(capacity);
+    if (!stripe->data)
+    {
+        printf("malloc failed.\n");
+        deflateEnd(&stream);
+        goto out;
+    }
+
+    bool last = (stripe->y + stripe->height == job->height);
+
+    stream.next_in = filtered;
+    stream.avail_in = filteredSize;
+    stream.next_out = stripe->data;
+    stream.avail_out = capacity;
+
+    int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last && ret != Z_STREAM_END) || (!last && ret != Z_OK) || stream.avail_in != 0)
+    {
+        printf("deflate failed.\n");
+        deflateEnd(&stream);
+        goto out;
+    }
+
+    stripe->size = capacity - stream.avail_out;
+    deflateEnd(&stream);
+
+    stripe->result = 0;
+
+out:
+    free(converted);
+    free(filtered);
+}
+
+static void go2_png_be32_put(uint8_t* dst, uint32_t value)
+{
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+static int go2_png_chunk_write(FILE* fp, const char* type, const uint8_t* data, uint32_t length)
+{
+    uint8_t header[8];
+    uint8_t footer[4];
+
+    go2_png_be32_put(header, length);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = crc32(0, header + 4, 4);
+    if (length > 0)
+    {
+        crc = crc32(crc, data, length);
+    }
+
+    go2_png_be32_put(footer, crc);
+
+    if (fwrite(header, sizeof(header), 1, fp) != 1) return -1;
+    if (length > 0 && fwrite(data, length, 1, fp) != 1) return -1;
+    if (fwrite(footer, sizeof(footer), 1, fp) != 1) return -1;
+
+    return 0;
+}
+
+static int go2_png_job_write(go2_png_job_t* job)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+    for (int i = 0; i < job->stripeCount; ++i)
+    {
+        if (job->stripes[i].result)
+        {
+            return -1;
+        }
+    }
+
+    FILE* fp = fopen(job->filename, "wb");
+    if (!fp)
+    {
+        printf("fopen failed. filename='%s'\n", job->filename);
+        return -1;
+    }
+
+    uint8_t ihdr[13];
+    go2_png_be32_put(ihdr, job->width);
+    go2_png_be32_put(ihdr + 4, job->height);
+    ihdr[8] = 8;                                // bit depth
+    ihdr[9] = (job->channels == 4) ? 6 : 2;     // RGBA : RGB
+    ihdr[10] = 0;                               // deflate
+    ihdr[11] = 0;                               // adaptive filtering
+    ihdr[12] = 0;                               // no interlace
+
+    // zlib header for a 32K window at the default level
+    static const uint8_t zlibHeader[2] = { 0x78, 0x9c };
+
+    uint32_t adler = adler32(0, NULL, 0);
+    for (int i = 0; i < job->stripeCount; ++i)
+    {
+        go2_png_stripe_t* stripe = &job->stripes[i];
+        adler = adler32_combine(adler, stripe->adler, (z_off_t)(job->width * job->channels + 1) * stripe->height);
+    }
+
+    uint8_t zlibTrailer[4];
+    go2_png_be32_put(zlibTrailer, adler);
+
+    int result = 0;
+    if (fwrite(signature, sizeof(signature), 1, fp) != 1 ||
+        go2_png_chunk_write(fp, "IHDR", ihdr, sizeof(ihdr)) ||
+        go2_png_chunk_write(fp, "IDAT", zlibHeader, sizeof(zlibHeader)))
+    {
+        result = -1;
+    }
+
+    for (int i = 0; i < job->stripeCount && !result; ++i)
+    {
+        result = go2_png_chunk_write(fp, "IDAT", job->stripes[i].data, job->stripes[i].size);
+    }
+
+    if (!result &&
+        (go2_png_chunk_write(fp, "IDAT", zlibTrailer, sizeof(zlibTrailer)) ||
+         go2_png_chunk_write(fp, "IEND", NULL, 0)))
+    {
+        result = -1;
+    }
+
+    if (fclose(fp))
+    {
+        result = -1;
+    }
+
+    if (result)
+    {
+        printf("writing '%s' failed.\n", job->filename);
+    }
+
+    return result;
+}
+
+static void go2_png_job_destroy(go2_png_job_t* job)
+{
+    for (int i = 0; i < job->stripeCount; ++i)
+    {
+        free(job->stripes[i].data);
+    }
+
+    if (job->ownsPixels)
+    {
+        free(job->pixels);
+    }
+
+    free(job->stripes);
+    free(job->filename);
+    free(job);
+}
+
+static go2_png_job_t* go2_png_job_create(const uint8_t* pixels, int width, int height, int stride, uint32_t format, const char* filename)
+{
+    uint32_t pngFormat;
+    int channels;
+
+    switch (format)
+    {
+        case DRM_FORMAT_RGBA8888:
+        case DRM_FORMAT_ARGB8888:
+        case DRM_FORMAT_RGBA5551:
+        case DRM_FORMAT_RGBA4444:
+            pngFormat = DRM_FORMAT_RGBA8888;
+            channels = 4;
+            break;
+
+        case DRM_FORMAT_RGBX8888:
+        case DRM_FORMAT_XRGB8888:
+        case DRM_FORMAT_RGB888:
+        case DRM_FORMAT_BGR888:
+        case DRM_FORMAT_RGB565:
+            pngFormat = DRM_FORMAT_RGB888;
+            channels = 3;
+            break;
+
+        default:
+            if (!go2_convert_format_supported(format))
+            {
+                printf("The image format is not supported.\n");
+                return NULL;
+            }
+
+            pngFormat = go2_convert_format_alpha(format) ? DRM_FORMAT_RGBA8888 : DRM_FORMAT_RGB888;
+            channels = go2_convert_format_alpha(format) ? 4 : 3;
+            break;
+    }
+
+    if (width <= 0 || height <= 0)
+    {
+        printf("invalid image size.\n");
+        return NULL;
+    }
+
+
+    go2_png_job_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->filename = strdup(filename);
+    result->pixels = (uint8_t*)pixels;
+    result->width = width;
+    result->height = height;
+    result->stride = stride;
+    result->format = format;
+    result->pngFormat = pngFormat;
+    result->channels = channels;
+
+    result->stripeCount = (height + STRIPE_ROWS - 1) / STRIPE_ROWS;
+    result->stripesRemaining = result->stripeCount;
+    result->stripes = malloc(result->stripeCount * sizeof(*result->stripes));
+    if (!result->filename || !result->stripes)
+    {
+        printf("malloc failed.\n");
+        goto err_00;
+    }
+
+    memset(result->stripes, 0, result->stripeCount * sizeof(*result->stripes));
+
+    for (int i = 0; i < result->stripeCount; ++i)
+    {
+        go2_png_stripe_t* stripe = &result->stripes[i];
+        stripe->job = result;
+        stripe->y = i * STRIPE_ROWS;
+        stripe->height = (height - stripe->y < STRIPE_ROWS) ? height - stripe->y : STRIPE_ROWS;
+        stripe->result = -1;
+    }
+
+    return result;
+
+
+err_00:
+    free(result->stripes);
+    free(result->filename);
+    free(result);
+    return NULL;
+}
+
+int go2_png_encode(const uint8_t* pixels, int width, int height, int stride, uint32_t format, const char* filename)
+{
+    go2_png_job_t* job = go2_png_job_create(pixels, width, height, stride, format, filename);
+    if (!job)
+    {
+        return -2;
+    }
+
+    for (int i = 0; i < job->stripeCount; ++i)
+    {
+        go2_png_stripe_encode(&job->stripes[i]);
+    }
+
+    int result = go2_png_job_write(job);
+    go2_png_job_destroy(job);
+
+    return result;
+}
+
+
+static void* go2_png_worker(void* arg)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&pool_mutex);
+
+        while (!pool_head)
+        {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+
+        go2_png_stripe_t* stripe = pool_head;
+        pool_head = stripe->next;
+        if (!pool_head) pool_tail = NULL;
+
+        pthread_mutex_unlock(&pool_mutex);
+
+
+        go2_png_stripe_encode(stripe);
+
+
+        go2_png_job_t* job = stripe->job;
+
+        pthread_mutex_lock(&pool_mutex);
+        bool finished = (--job->stripesRemaining == 0);
+        pthread_mutex_unlock(&pool_mutex);
+
+        if (finished)
+        {
+            // The last stripe to finish writes the file
+            int result = go2_png_job_write(job);
+            if (job->complete)
+            {
+                job->complete(result, job->completeData);
+            }
+
+            go2_png_job_destroy(job);
+
+            pthread_mutex_lock(&pool_mutex);
+            pool_jobs--;
+            pthread_cond_broadcast(&pool_idle_cond);
+            pthread_mutex_unlock(&pool_mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void go2_png_pool_start()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > WORKER_COUNT_MAX) count = WORKER_COUNT_MAX;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (long i = 0; i < count; ++i)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, go2_png_worker, NULL) == 0)
+        {
+            pool_workers++;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (!pool_workers)
+    {
+        printf("go2_png_pool_start: no worker threads, encoding synchronously.\n");
+    }
+}
+
+int go2_png_encode_async(uint8_t* pixels, int width, int height, int stride, uint32_t format, const char* filename,
+                         go2_png_complete_t complete, void* data)
+{
+    pthread_once(&pool_once, go2_png_pool_start);
+
+    go2_png_job_t* job = go2_png_job_create(pixels, width, height, stride, format, filename);
+    if (!job)
+    {
+        free(pixels);
+        return -2;
+    }
+
+    job->ownsPixels = true;
+    job->complete = complete;
+    job->completeData = data;
+
+    if (!pool_workers)
+    {
+        for (int i = 0; i < job->stripeCount; ++i)
+        {
+            go2_png_stripe_encode(&job->stripes[i]);
+        }
+
+        int result = go2_png_job_write(job);
+        if (complete)
+        {
+            complete(result, data);
+        }
+
+        go2_png_job_destroy(job);
+
+        return result;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+
+    for (int i = 0; i < job->stripeCount; ++i)
+    {
+        go2_png_stripe_t* stripe = &job->stripes[i];
+        if (pool_tail)
+        {
+            pool_tail->next = stripe;
+        }
+        else
+        {
+            pool_head = stripe;
+        }
+
+        pool_tail = stripe;
+    }
+
+    pool_jobs++;
+    pthread_cond_broadcast(&pool_cond);
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    return 0;
+}
+
+void go2_png_wait()
+{
+    pthread_mutex_lock(&pool_mutex);
+
+    while (pool_jobs > 0)
+    {
+        pthread_cond_wait(&pool_idle_cond, &pool_mutex);
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdint.h>
+
+
+// PNG encoder used for screenshots. Images are split into stripes of rows
+// that are filtered and deflated independently on a pool of worker threads,
+// then joined into a single zlib stream.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int go2_png_encode(const uint8_t* pixels, int width, int height, int stride, uint32_t format, const char* filename);
+
+typedef void (*go2_png_complete_t)(int result, void* data);
+
+// Takes ownership of pixels, which must come from malloc. Once the file is
+// written (or has failed) complete is called with the result, on a worker
+// thread. It is not called if -2 is returned.
+int go2_png_encode_async(uint8_t* pixels, int width, int height, int stride, uint32_t format, const char* filename,
+                         go2_png_complete_t complete, void* data);
+void go2_png_wait();
+
+#ifdef __cplusplus
+}
+#endif
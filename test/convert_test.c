@@ -0,0 +1,148 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// Bit-exact self-test for go2_convert. Not part of the library build:
+//   gcc -O2 -Wall -Isrc -I/usr/include/libdrm test/convert_test.c src/convert.c src/blitter.c -o convert_test
+//
+// Every pair of formats is converted with go2_convert (SIMD) and compared
+// with go2_convert_reference, using widths that exercise the vector loops
+// and their scalar tails. The software blitter, whose native layouts follow
+// the RK byte order, is then checked against the reference as well.
+
+#include "convert.h"
+#include "blitter.h"
+
+#include <drm/drm_fourcc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const uint32_t formats[] =
+{
+    DRM_FORMAT_XRGB4444, DRM_FORMAT_XBGR4444, DRM_FORMAT_RGBX4444, DRM_FORMAT_BGRX4444,
+    DRM_FORMAT_ARGB4444, DRM_FORMAT_ABGR4444, DRM_FORMAT_RGBA4444, DRM_FORMAT_BGRA4444,
+    DRM_FORMAT_XRGB1555, DRM_FORMAT_XBGR1555, DRM_FORMAT_RGBX5551, DRM_FORMAT_BGRX5551,
+    DRM_FORMAT_ARGB1555, DRM_FORMAT_ABGR1555, DRM_FORMAT_RGBA5551, DRM_FORMAT_BGRA5551,
+    DRM_FORMAT_RGB565, DRM_FORMAT_BGR565,
+    DRM_FORMAT_RGB888, DRM_FORMAT_BGR888,
+    DRM_FORMAT_XRGB8888, DRM_FORMAT_XBGR8888, DRM_FORMAT_RGBX8888, DRM_FORMAT_BGRX8888,
+    DRM_FORMAT_ARGB8888, DRM_FORMAT_ABGR8888, DRM_FORMAT_RGBA8888, DRM_FORMAT_BGRA8888,
+    DRM_FORMAT_XRGB2101010, DRM_FORMAT_XBGR2101010, DRM_FORMAT_RGBX1010102, DRM_FORMAT_BGRX1010102,
+    DRM_FORMAT_ARGB2101010, DRM_FORMAT_ABGR2101010, DRM_FORMAT_RGBA1010102, DRM_FORMAT_BGRA1010102,
+};
+
+#define FORMAT_COUNT (sizeof(formats) / sizeof(formats[0]))
+#define HEIGHT (3)
+#define PADDING (16)
+
+static const int widths[] = { 1, 7, 16, 63, 64, 65, 131 };
+
+
+static void fourcc_print(uint32_t format)
+{
+    printf("%c%c%c%c", format & 0xff, format >> 8 & 0xff, format >> 16 & 0xff, format >> 24);
+}
+
+static int compare(const char* name, uint32_t srcFormat, uint32_t dstFormat, int width,
+                   const uint8_t* expected, const uint8_t* actual, int size)
+{
+    if (memcmp(expected, actual, size) == 0)
+    {
+        return 0;
+    }
+
+    printf("%s: ", name);
+    fourcc_print(srcFormat);
+    printf(" -> ");
+    fourcc_print(dstFormat);
+    printf(" width %d differs from the reference.\n", width);
+
+    return 1;
+}
+
+int main()
+{
+    int failures = 0;
+    int checked = 0;
+
+    for (int w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w)
+    {
+        int width = widths[w];
+
+        for (int i = 0; i < FORMAT_COUNT; ++i)
+        {
+            uint32_t srcFormat = formats[i];
+            int srcStride = width * go2_convert_format_bytes(srcFormat) + PADDING;
+
+            uint8_t* src = malloc(srcStride * HEIGHT);
+            for (int k = 0; k < srcStride * HEIGHT; ++k)
+            {
+                src[k] = rand();
+            }
+
+            for (int j = 0; j < FORMAT_COUNT; ++j)
+            {
+                uint32_t dstFormat = formats[j];
+                int dstStride = width * go2_convert_format_bytes(dstFormat) + PADDING;
+                int size = dstStride * HEIGHT;
+
+                // Padding bytes must survive, so both outputs start identical
+                uint8_t* expected = malloc(size);
+                uint8_t* actual = malloc(size);
+                memset(expected, 0x5a, size);
+                memset(actual, 0x5a, size);
+
+                go2_convert_reference(src, srcStride, srcFormat, expected, dstStride, dstFormat, width, HEIGHT);
+
+                go2_convert(src, srcStride, srcFormat, actual, dstStride, dstFormat, width, HEIGHT);
+                failures += compare("go2_convert", srcFormat, dstFormat, width, expected, actual, size);
+
+                // RGA handles XRGB8888 as BGRA_8888, so like RGA the blitter
+                // carries its fourth byte to and from alpha.
+                bool xrgb = (srcFormat == DRM_FORMAT_XRGB8888 || dstFormat == DRM_FORMAT_XRGB8888);
+                if (xrgb && (go2_convert_format_alpha(srcFormat) || go2_convert_format_alpha(dstFormat)))
+                {
+                    checked++;
+                    free(expected);
+                    free(actual);
+                    continue;
+                }
+
+                memset(actual, 0x5a, size);
+                go2_blitter_sw_blit(src, srcStride, srcFormat, 0, 0, width, HEIGHT,
+                                    actual, dstStride, dstFormat, 0, 0, width, HEIGHT,
+                                    GO2_ROTATION_DEGREES_0);
+                failures += compare("go2_blitter_sw_blit", srcFormat, dstFormat, width, expected, actual, size);
+
+                checked++;
+
+                free(expected);
+                free(actual);
+            }
+
+            free(src);
+        }
+    }
+
+    printf("%d conversions checked, %d failures.\n", checked, failures);
+
+    return failures ? 1 : 0;
+}
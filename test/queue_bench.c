@@ -0,0 +1,359 @@
+/*
+libgo2 - Support library for the ODROID-GO Advance
+Copyright (C) 2020 OtherCrashOverride
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// Queue benchmark. Not part of the library build:
+//   gcc -O2 -Wall -Isrc test/queue_bench.c src/queue.c -o queue_bench -lpthread
+//
+// Compares the shifting array queue go2_queue used to be with the ring
+// buffer go2_queue and go2_spsc_queue:
+//   - push/pop throughput on one thread, with the queue kept at a given depth
+//   - cross-thread handoff latency, as half of a ping-pong round trip.
+// The array and ring queues are not thread safe and are handed off under a
+// mutex and condition variable, the way the presenter used them.
+
+#include "queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+
+#define THROUGHPUT_OPS (4 * 1024 * 1024)
+#define HANDOFF_ROUNDS (100000)
+
+
+// The queue before the ring buffer rewrite: pop shifts every element down.
+typedef struct array_queue
+{
+    int capacity;
+    int count;
+    void** data;
+} array_queue_t;
+
+static array_queue_t* array_queue_create(int capacity)
+{
+    array_queue_t* result = malloc(sizeof(*result));
+    if (!result)
+    {
+        printf("malloc failed.\n");
+        return NULL;
+    }
+
+    memset(result, 0, sizeof(*result));
+
+
+    result->capacity = capacity;
+    result->data = malloc(capacity * sizeof(void*));
+    if (!result->data)
+    {
+        printf("data malloc failed.\n");
+        free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+static int array_queue_push(array_queue_t* queue, void* value)
+{
+    if (queue->count >= queue->capacity)
+    {
+        return -1;
+    }
+
+    queue->data[queue->count] = value;
+    queue->count++;
+
+    return 0;
+}
+
+static void* array_queue_pop(array_queue_t* queue)
+{
+    if (queue->count <= 0)
+    {
+        return NULL;
+    }
+
+    void* result = queue->data[0];
+
+    for (int i = 0; i < queue->count - 1; ++i)
+    {
+        queue->data[i] = queue->data[i + 1];
+    }
+
+    queue->count--;
+
+    return result;
+}
+
+static void array_queue_destroy(array_queue_t* queue)
+{
+    free(queue->data);
+    free(queue);
+}
+
+
+typedef enum bench_kind
+{
+    BENCH_ARRAY = 0,
+    BENCH_RING,
+    BENCH_SPSC
+} bench_kind_t;
+
+static const char* bench_names[] = { "array", "go2_queue", "go2_spsc_queue" };
+
+typedef struct bench_queue
+{
+    bench_kind_t kind;
+    array_queue_t* array;
+    go2_queue_t* ring;
+    go2_spsc_queue_t* spsc;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} bench_queue_t;
+
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_queue_init(bench_queue_t* queue, bench_kind_t kind, int capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    queue->kind = kind;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    switch (kind)
+    {
+        case BENCH_ARRAY:
+            queue->array = array_queue_create(capacity);
+            return queue->array ? 0 : -1;
+
+        case BENCH_RING:
+            queue->ring = go2_queue_create(capacity);
+            return queue->ring ? 0 : -1;
+
+        default:
+            queue->spsc = go2_spsc_queue_create(capacity);
+            return queue->spsc ? 0 : -1;
+    }
+}
+
+static void bench_queue_deinit(bench_queue_t* queue)
+{
+    if (queue->array) array_queue_destroy(queue->array);
+    if (queue->ring) go2_queue_destroy(queue->ring);
+    if (queue->spsc) go2_spsc_queue_destroy(queue->spsc);
+
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+// Single threaded: no locking for any kind
+static int bench_queue_push(bench_queue_t* queue, void* value)
+{
+    switch (queue->kind)
+    {
+        case BENCH_ARRAY:
+            return array_queue_push(queue->array, value);
+
+        case BENCH_RING:
+            return go2_queue_push(queue->ring, value);
+
+        default:
+            return go2_spsc_queue_push(queue->spsc, value, 0);
+    }
+}
+
+static void* bench_queue_pop(bench_queue_t* queue)
+{
+    void* result = NULL;
+
+    switch (queue->kind)
+    {
+        case BENCH_ARRAY:
+            return array_queue_pop(queue->array);
+
+        case BENCH_RING:
+            return go2_queue_pop(queue->ring);
+
+        default:
+            go2_spsc_queue_pop(queue->spsc, &result, 0);
+            return result;
+    }
+}
+
+// Cross thread: the locked queues signal a condition variable, the SPSC
+// queue blocks on its own.
+static void bench_queue_send(bench_queue_t* queue, void* value)
+{
+    if (queue->kind == BENCH_SPSC)
+    {
+        go2_spsc_queue_push(queue->spsc, value, -1);
+        return;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    bench_queue_push(queue, value);
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void* bench_queue_receive(bench_queue_t* queue)
+{
+    void* result = NULL;
+
+    if (queue->kind == BENCH_SPSC)
+    {
+        go2_spsc_queue_pop(queue->spsc, &result, -1);
+        return result;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    while ((result = bench_queue_pop(queue)) == NULL)
+    {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return result;
+}
+
+
+static void bench_throughput(bench_kind_t kind, int depth)
+{
+    bench_queue_t queue;
+    if (bench_queue_init(&queue, kind, depth + 1))
+    {
+        return;
+    }
+
+    // Keep depth items queued so pop pays for whatever it has to move
+    for (int i = 0; i < depth; ++i)
+    {
+        bench_queue_push(&queue, (void*)(uintptr_t)(i + 1));
+    }
+
+    uint64_t start = now_ns();
+
+    uintptr_t check = 0;
+    for (int i = 0; i < THROUGHPUT_OPS; ++i)
+    {
+        bench_queue_push(&queue, (void*)(uintptr_t)(i + 1));
+        check += (uintptr_t)bench_queue_pop(&queue);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    printf("  %-16s depth %4d: %7.2f ns per push/pop (%lu)\n",
+           bench_names[kind], depth, (double)elapsed / THROUGHPUT_OPS, (unsigned long)(check & 0xff));
+
+    bench_queue_deinit(&queue);
+}
+
+
+typedef struct handoff
+{
+    bench_queue_t ping;
+    bench_queue_t pong;
+} handoff_t;
+
+static void* handoff_echo(void* arg)
+{
+    handoff_t* handoff = (handoff_t*)arg;
+
+    for (int i = 0; i < HANDOFF_ROUNDS; ++i)
+    {
+        bench_queue_send(&handoff->pong, bench_queue_receive(&handoff->ping));
+    }
+
+    return NULL;
+}
+
+static void bench_handoff(bench_kind_t kind)
+{
+    handoff_t handoff;
+    if (bench_queue_init(&handoff.ping, kind, 4))
+    {
+        return;
+    }
+
+    if (bench_queue_init(&handoff.pong, kind, 4))
+    {
+        bench_queue_deinit(&handoff.ping);
+        return;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, handoff_echo, &handoff))
+    {
+        printf("pthread_create failed.\n");
+        goto out;
+    }
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < HANDOFF_ROUNDS; ++i)
+    {
+        bench_queue_send(&handoff.ping, (void*)(uintptr_t)(i + 1));
+        bench_queue_receive(&handoff.pong);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    pthread_join(thread, NULL);
+
+    printf("  %-16s %7.0f ns per handoff\n", bench_names[kind], (double)elapsed / HANDOFF_ROUNDS / 2);
+
+out:
+    bench_queue_deinit(&handoff.pong);
+    bench_queue_deinit(&handoff.ping);
+}
+
+
+int main()
+{
+    static const int depths[] = { 0, 2, 8, 64, 512 };
+
+    printf("push/pop throughput:\n");
+    for (int d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); ++d)
+    {
+        for (int kind = BENCH_ARRAY; kind <= BENCH_SPSC; ++kind)
+        {
+            bench_throughput((bench_kind_t)kind, depths[d]);
+        }
+    }
+
+    printf("cross-thread handoff latency:\n");
+    for (int kind = BENCH_ARRAY; kind <= BENCH_SPSC; ++kind)
+    {
+        bench_handoff((bench_kind_t)kind);
+    }
+
+    return 0;
+}